@@ -0,0 +1,1041 @@
+// libsudoku.c - reentrant Sudoku engine: solver, counter, generator, checks
+// Build: see CMakeLists.txt (static and shared libsudoku); sudoku.c includes
+// this file directly, so the command-line tool stays a single compile.
+// Copyright 2025. Bogdan Drozdov. All rights reserved.
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L      // clock_gettime
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "sudoku.h"
+
+// Phase trace hook: sudoku.c defines TRACE_SCOPE before including this
+// file (see "Tracing" there); built alone, the library has none.
+#ifndef TRACE_SCOPE
+#define TRACE_SCOPE(name) ((void)0)
+#endif
+
+#define N 9
+#define BOX 3
+#define ALL ((1<<9)-1)
+
+typedef struct {
+    int grid[N][N];       // 0 == empty, 1..9 == value
+} Board;
+
+typedef struct {
+    unsigned row[N], col[N], box[N];
+} Masks;
+
+static inline int box_index(int r, int c){ return (r/BOX)*BOX + (c/BOX); }
+
+// Table popcount: without -mpopcnt __builtin_popcount is a libgcc call.
+static const uint8_t popcount_table[1<<N] = {
+#define P2(n) n, n+1, n+1, n+2
+#define P4(n) P2(n), P2(n+1), P2(n+1), P2(n+2)
+#define P6(n) P4(n), P4(n+1), P4(n+1), P4(n+2)
+#define P8(n) P6(n), P6(n+1), P6(n+1), P6(n+2)
+    P8(0), P8(1)
+#undef P2
+#undef P4
+#undef P6
+#undef P8
+};
+static inline int popcount9(unsigned x){ return popcount_table[x]; }
+
+static inline int lsb_index(unsigned x){ return __builtin_ctz(x); }
+
+static void masks_init(Masks* m, const Board* b){
+    for(int i=0;i<N;i++){ m->row[i]=m->col[i]=m->box[i]=0; }
+    for(int i=0;i<N;i++){
+        for(int j=0;j<N;j++){
+            int v=b->grid[i][j];
+            if(v){
+                unsigned bit=1u<<(v-1);
+                m->row[i]|=bit; m->col[j]|=bit; m->box[box_index(i,j)]|=bit;
+            }
+        }
+    }
+}
+
+static inline unsigned used_mask(const Masks* m, int r, int c){
+    return m->row[r] | m->col[c] | m->box[box_index(r,c)];
+}
+
+static inline unsigned candidates_mask(const Masks* m, int r, int c){
+    return (~used_mask(m,r,c)) & ALL;
+}
+
+static void apply_set(Board* b, Masks* m, int r, int c, int v){
+    b->grid[r][c]=v;
+    unsigned bit = 1u<<(v-1);
+    m->row[r] |= bit; m->col[c] |= bit; m->box[box_index(r,c)] |= bit;
+}
+
+static void apply_clear(Board* b, Masks* m, int r, int c){
+    int v=b->grid[r][c];
+    if(!v) return;
+    unsigned bit=1u<<(v-1);
+    m->row[r] &= ~bit; m->col[c] &= ~bit; m->box[box_index(r,c)] &= ~bit;
+    b->grid[r][c]=0;
+}
+
+static void copy_board(Board* dst, const Board* src){
+    memcpy(dst, src, sizeof(Board));
+}
+
+typedef struct { int r,c; unsigned cand; } Choice;
+
+static bool find_best_cell(const Board* b, const Masks* m, Choice* ch){
+    unsigned bestMask=0; int bestR=-1, bestC=-1; int bestCount=10;
+    for(int r=0;r<N;r++){
+        for(int c=0;c<N;c++){
+            if(b->grid[r][c]) continue;
+            unsigned cand=candidates_mask(m,r,c);
+            int cnt=popcount9(cand);
+            if(cnt==0) return false; // dead
+            if(cnt<bestCount){
+                bestCount=cnt; bestMask=cand; bestR=r; bestC=c;
+                if(cnt==1) goto done; // MRV shortcut
+            }
+        }
+    }
+done:
+    if(bestR==-1) return false;
+    ch->r=bestR; ch->c=bestC; ch->cand=bestMask;
+    return true;
+}
+
+// Order in which a search tries the candidate digits of a cell.
+typedef enum {
+    ORDER_ASCENDING,         // 1 up: the default everywhere
+    ORDER_DESCENDING,        // 9 down
+    ORDER_LCV,               // least constraining first: in the fewest empty peers' candidates
+    ORDER_GUIDED,            // the guide grid's digit first, then 1 up
+    ORDER_AVOID              // the guide grid's digit last, then other solutions come first
+} ValueOrder;
+
+static inline void lcv_add(int score[N], unsigned x){
+    for(; x; x&=x-1) score[lsb_index(x)]++;
+}
+
+// The digits of 'cand' at (r,c) as single bits in out[], in the order 'o'
+// tries them; returns how many. 'guide' is read for ORDER_GUIDED and
+// ORDER_AVOID only (its empty cells fall back to 1 up).
+static int order_values(const Board* b, const Masks* m, int r, int c, unsigned cand,
+                        ValueOrder o, const Board* guide, unsigned out[N]){
+    int n=0;
+    if(o==ORDER_DESCENDING){
+        for(; cand; cand&=~out[n-1]) out[n++]=1u<<(31-__builtin_clz(cand));
+        return n;
+    }
+    unsigned g=0;
+    if((o==ORDER_GUIDED || o==ORDER_AVOID) && guide->grid[r][c]) g=cand & 1u<<(guide->grid[r][c]-1);
+    if(o==ORDER_GUIDED && g) out[n++]=g;
+    for(unsigned rest=cand&~g; rest; rest&=rest-1) out[n++]=rest & -rest;
+    if(o==ORDER_AVOID && g) out[n++]=g;
+    if(o!=ORDER_LCV || n<2) return n;
+    // score each digit by the empty peers that could still take it
+    int score[N]={0};
+    for(int j=0;j<N;j++){
+        int br=r/BOX*BOX + j/BOX, bc=c/BOX*BOX + j%BOX;
+        if(j!=c && !b->grid[r][j]) lcv_add(score,cand & candidates_mask(m,r,j));
+        if(j!=r && !b->grid[j][c]) lcv_add(score,cand & candidates_mask(m,j,c));
+        if(br!=r && bc!=c && !b->grid[br][bc]) lcv_add(score,cand & candidates_mask(m,br,bc));
+    }
+    for(int i=1;i<n;i++){            // insertion sort: ties keep 1 up
+        unsigned x=out[i];
+        int k=i;
+        for(; k>0 && score[lsb_index(out[k-1])]>score[lsb_index(x)]; k--) out[k]=out[k-1];
+        out[k]=x;
+    }
+    return n;
+}
+
+/* ---------- Solver helpers at file scope (no nested functions) ---------- */
+
+typedef struct {
+    unsigned long long nodes;
+    unsigned long long tt_probes, tt_hits, tt_stores, tt_evictions;
+    size_t tt_bytes;
+} SolverStats;
+
+/* Transposition table for count_rec. A node's subtree depends only on which
+   cells are filled and on the row/column/box digit masks, so the key hashes
+   exactly that: fillings that differ by swapped digits in a rectangle land on
+   the same entry, and entries stay valid from one grid to the next.
+   Entries hold exact subtree counts in 64-byte buckets of four; a new
+   entry evicts the one that took the fewest nodes to compute. */
+
+#define TT_WAYS 4
+#define TT_MIN_WORK 8        // cheaper subtrees are not worth a slot
+#define TT_MIN_LIMIT 64      // below this count_solutions_ex stops before reuse pays
+
+typedef struct {
+    uint64_t key;
+    uint32_t count;          // exact completions of the subtree
+    uint32_t work;           // nodes spent computing it (saturating)
+} TTEntry;
+
+typedef struct {
+    TTEntry* e;
+    size_t mask;             // bucket count - 1
+    size_t bytes;
+} TransTable;
+
+static bool tt_init(TransTable* tt, size_t bytes){
+    size_t buckets=1;
+    while(buckets*2*TT_WAYS*sizeof(TTEntry) <= bytes) buckets*=2;
+    tt->e=calloc(buckets*TT_WAYS,sizeof(TTEntry));
+    tt->mask=buckets-1;
+    tt->bytes=buckets*TT_WAYS*sizeof(TTEntry);
+    return tt->e!=NULL;
+}
+
+static void tt_free(TransTable* tt){
+    free(tt->e); tt->e=NULL;
+}
+
+static inline uint64_t mix64(uint64_t x){
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x>>30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x>>27)) * 0x94D049BB133111EBull;
+    return x ^ (x>>31);
+}
+
+// Generation and randomized search draw from a splitmix64 stream owned by
+// the caller, never from rand(), so contexts on different threads stay
+// independent.
+typedef struct { uint64_t s; } Rng;
+
+static uint64_t rng_next(Rng* g){
+    g->s += 0x9E3779B97F4A7C15ull;
+    return mix64(g->s);
+}
+
+// find_best_cell scanning from a random cell, wrapping around, so ties
+// between the most constrained cells go a different way each call: one
+// random draw per node instead of one per tie.
+static bool find_best_cell_rand(const Board* b, const Masks* m, Choice* ch, Rng* g){
+    int start=(int)(rng_next(g)%(N*N)), bestCount=10;
+    for(int k=0;k<N*N;k++){
+        int i = start+k<N*N ? start+k : start+k-N*N;
+        int r=i/N, c=i%N;
+        if(b->grid[r][c]) continue;
+        unsigned cand=candidates_mask(m,r,c);
+        int cnt=popcount9(cand);
+        if(cnt==0) return false;
+        if(cnt<bestCount){
+            bestCount=cnt; ch->r=r; ch->c=c; ch->cand=cand;
+            if(cnt==1) break;
+        }
+    }
+    return bestCount<10;
+}
+
+// Shuffles the first n entries of a[] (randomized digit order).
+static inline void shuffle_bits(unsigned* a, int n, Rng* g){
+    for(int i=n-1;i>0;i--){
+        int j=(int)(rng_next(g)%(uint64_t)(i+1));
+        unsigned t=a[i]; a[i]=a[j]; a[j]=t;
+    }
+}
+
+// Luby's universal restart sequence 1,1,2,1,1,2,4,1,1,2,1,1,2,4,8,... for
+// i from 1: within a log factor of the best fixed cutoff for any run
+// time distribution, and growing without bound, so some run always
+// finishes and a restarted search stays complete.
+static unsigned long long luby(unsigned long long i){
+    for(;;){
+        int k=1;
+        while((1ull<<k)-1 < i) k++;
+        if(i==(1ull<<k)-1) return 1ull<<(k-1);
+        i -= (1ull<<(k-1))-1;
+    }
+}
+
+#define RESTART_UNIT 256         // nodes per Luby step
+
+// Key delta for placing v at (r,c): the cell becomes filled and v joins its units.
+static inline uint64_t zobrist_set(int r, int c, int v){
+    int d=v-1;
+    return mix64((uint64_t)(r*N+c))
+         ^ mix64((uint64_t)(N*N + r*N+d))
+         ^ mix64((uint64_t)(2*N*N + c*N+d))
+         ^ mix64((uint64_t)(3*N*N + box_index(r,c)*N+d));
+}
+
+static uint64_t zobrist_board(const Board* b){
+    uint64_t key=0;
+    for(int r=0;r<N;r++) for(int c=0;c<N;c++)
+        if(b->grid[r][c]) key ^= zobrist_set(r,c,b->grid[r][c]);
+    return key ? key : 1;    // 0 marks an empty slot
+}
+
+static const TTEntry* tt_probe(const TransTable* tt, uint64_t key, SolverStats* st){
+    const TTEntry* bucket=&tt->e[(key & tt->mask)*TT_WAYS];
+    st->tt_probes++;
+    for(int i=0;i<TT_WAYS;i++)
+        if(bucket[i].key==key){ st->tt_hits++; return &bucket[i]; }
+    return NULL;
+}
+
+static void tt_store(TransTable* tt, uint64_t key, int count, unsigned long long work, SolverStats* st){
+    if(work<TT_MIN_WORK) return;
+    TTEntry* bucket=&tt->e[(key & tt->mask)*TT_WAYS];
+    TTEntry* victim=&bucket[0];
+    for(int i=0;i<TT_WAYS;i++){
+        if(bucket[i].key==0 || bucket[i].key==key){ victim=&bucket[i]; break; }
+        if(bucket[i].work < victim->work) victim=&bucket[i];
+    }
+    if(victim->key && victim->key!=key) st->tt_evictions++;
+    victim->key=key;
+    victim->count=(uint32_t)count;
+    victim->work = work>UINT32_MAX ? UINT32_MAX : (uint32_t)work;
+    st->tt_stores++;
+}
+
+// What a search may spend: it gives up past a node limit or a deadline,
+// or once another thread sets one of two flags. The clock and the flags
+// are looked at every SEARCH_POLL+1 nodes, a few tens of microseconds.
+typedef struct {
+    unsigned long long limit;   // nodes (0: none)
+    uint64_t deadline;          // lat_now() time (0: none)
+    const atomic_int* stop;     // nonzero: give up (optional)
+    const int* cancel;          // the caller's flag, a plain int (optional)
+    bool gave_up;               // no answer either way
+} Bounds;
+
+#define SEARCH_POLL 255
+
+static inline uint64_t lat_now(void);
+
+// Marks 'b' given up if its time is over or a flag is set; returns that.
+static inline bool bounds_check(Bounds* b){
+    if((b->stop && atomic_load_explicit(b->stop,memory_order_relaxed))
+       || (b->cancel && __atomic_load_n(b->cancel,__ATOMIC_RELAXED))
+       || (b->deadline && lat_now()>=b->deadline))
+        b->gave_up=true;
+    return b->gave_up;
+}
+
+// Marks 'b' given up once 'nodes' passes a bound; returns that.
+static inline bool bounds_hit(Bounds* b, unsigned long long nodes){
+    if(b->limit && nodes>b->limit) b->gave_up=true;
+    else if((nodes & SEARCH_POLL)==0) bounds_check(b);
+    return b->gave_up;
+}
+
+typedef struct {
+    TransTable* tt;          // NULL: plain search
+    Bounds* bound;           // optional
+    ValueOrder order;
+    const Board* guide;      // for ORDER_GUIDED and ORDER_AVOID
+    SolverStats st;
+} CountCtx;
+
+// Count solutions up to 'lim' using MRV backtracking.
+static int count_rec(Board* bb, Masks* mm, int lim, CountCtx* cx, uint64_t key){
+    cx->st.nodes++;
+    if(cx->bound && bounds_hit(cx->bound,cx->st.nodes)) return 0;
+    // find next cell
+    bool any_empty=false;
+    for(int r=0;r<N && !any_empty;r++)
+        for(int c=0;c<N;c++)
+            if(!bb->grid[r][c]) { any_empty=true; break; }
+    if(!any_empty) return 1;
+
+    if(cx->tt){
+        const TTEntry* e=tt_probe(cx->tt,key,&cx->st);
+        if(e) return e->count<(uint32_t)lim ? (int)e->count : lim;   // stored subtrees are whole: cap them
+    }
+    unsigned long long start=cx->st.nodes;
+
+    Choice ch;
+    if(!find_best_cell(bb,mm,&ch)) return 0;
+
+    int total=0;
+    unsigned order[N];
+    int k=order_values(bb,mm,ch.r,ch.c,ch.cand,cx->order,cx->guide,order);
+    for(int i=0;i<k;i++){
+        int v=lsb_index(order[i])+1;
+        apply_set(bb,mm,ch.r,ch.c,v);
+        uint64_t child = cx->tt ? key ^ zobrist_set(ch.r,ch.c,v) : 0;
+        total += count_rec(bb,mm,lim-total,cx,child);
+        apply_clear(bb,mm,ch.r,ch.c);
+        if(total>=lim || (cx->bound && cx->bound->gave_up)) return total;   // partial: never stored
+    }
+    if(cx->tt) tt_store(cx->tt,key,total,cx->st.nodes-start,&cx->st);
+    return total;
+}
+
+// Count solutions up to 'limit', trying digits in order 'o' ('guide' as
+// for order_values). 'tt' (optional) is used once the limit is large
+// enough for repeated subtrees to matter; 'st' (optional) accumulates.
+// With 'bound' (optional) given up, the result is the solutions found so
+// far, a lower bound.
+static int count_ordered(Board* b, int limit, TransTable* tt, ValueOrder o, const Board* guide,
+                         Bounds* bound, SolverStats* st){
+    TRACE_SCOPE("count");
+    Masks m; masks_init(&m,b);
+    Board tmp=*b;
+    CountCtx cx={ .tt = limit>=TT_MIN_LIMIT ? tt : NULL, .bound=bound, .order=o, .guide=guide };
+    int n=count_rec(&tmp,&m,limit,&cx, cx.tt ? zobrist_board(b) : 0);
+    if(st){
+        st->nodes += cx.st.nodes;
+        st->tt_probes += cx.st.tt_probes; st->tt_hits += cx.st.tt_hits;
+        st->tt_stores += cx.st.tt_stores; st->tt_evictions += cx.st.tt_evictions;
+        if(cx.tt) st->tt_bytes = cx.tt->bytes;
+    }
+    return n;
+}
+
+static int count_solutions_ex(Board* b, int limit, TransTable* tt, SolverStats* st){
+    return count_ordered(b,limit,tt,ORDER_ASCENDING,NULL,NULL,st);
+}
+
+// One backtracking search: the policy it follows and what it cost. The
+// default (all zero) is MRV with candidates from low to high, unbounded.
+typedef struct {
+    ValueOrder order;
+    const Board* guide;         // for ORDER_GUIDED and ORDER_AVOID
+    bool singles;               // branch on a hidden single when MRV finds none
+    Rng* rng;                   // break MRV ties and shuffle digits (over 'order')
+    bool restart;               // with rng: Luby restarts (see search_solve)
+    unsigned long long restarts;    // runs cut off
+    Bounds bound;
+    unsigned long long nodes;
+} Search;
+
+// A digit that has one place left in some row, column or box, as a Choice
+// of one candidate. Returns 1 if found, 0 if none, -1 if some digit has no
+// place left in a unit (a dead end MRV cannot see).
+static int find_hidden_single(const Board* b, const Masks* m, Choice* ch){
+    for(int u=0;u<3*N;u++){
+        unsigned once=0, twice=0, cand[N];
+        int rr[N], cc[N], k=0;
+        for(int j=0;j<N;j++){
+            int r = u<N ? u : u<2*N ? j : (u-2*N)/BOX*BOX + j/BOX;
+            int c = u<N ? j : u<2*N ? u-N : (u-2*N)%BOX*BOX + j%BOX;
+            if(b->grid[r][c]) continue;
+            cand[k]=candidates_mask(m,r,c);
+            twice|=once&cand[k]; once|=cand[k];
+            rr[k]=r; cc[k]=c; k++;
+        }
+        if(!k) continue;
+        unsigned used = u<N ? m->row[u] : u<2*N ? m->col[u-N] : m->box[u-2*N];
+        if((once|used)!=ALL) return -1;
+        unsigned single=once&~twice;
+        if(!single) continue;
+        unsigned bit=single & -single;
+        for(int i=0;i<k;i++)
+            if(cand[i]&bit){ ch->r=rr[i]; ch->c=cc[i]; ch->cand=bit; return 1; }
+    }
+    return 0;
+}
+
+// Solve in-place; returns true if solved. Counts calls in s->nodes.
+static bool solve_rec(Board* bb, Masks* mm, Search* s){
+    ++s->nodes;
+    if(bounds_hit(&s->bound,s->nodes)) return false;
+    // Are we complete?
+    bool any_empty=false;
+    for(int r=0;r<N && !any_empty;r++)
+        for(int c=0;c<N;c++)
+            if(!bb->grid[r][c]) { any_empty=true; break; }
+    if(!any_empty) return true;
+
+    Choice ch;
+    if(!(s->rng ? find_best_cell_rand(bb,mm,&ch,s->rng) : find_best_cell(bb,mm,&ch))) return false;
+    if(s->singles && popcount9(ch.cand)>1 && find_hidden_single(bb,mm,&ch)<0) return false;
+    unsigned order[N];
+    int k=order_values(bb,mm,ch.r,ch.c,ch.cand,s->order,s->guide,order);
+    if(s->rng) shuffle_bits(order,k,s->rng);
+    for(int i=0;i<k;i++){
+        int v=lsb_index(order[i])+1;
+        apply_set(bb,mm,ch.r,ch.c,v);
+        if(solve_rec(bb,mm,s)) return true;
+        apply_clear(bb,mm,ch.r,ch.c);
+        if(s->bound.gave_up) return false;
+    }
+    return false;
+}
+
+// Solve in-place following 's'; on false 'b' is unchanged, and
+// s->bound.gave_up tells a search out of budget from a proof of no
+// solution.
+static bool search_solve(Board* b, Search* s){
+    TRACE_SCOPE("solve");
+    Masks m; masks_init(&m,b);
+    if(!s->rng || !s->restart) return solve_rec(b,&m,s);
+    // each run gets its Luby share on top of what the runs before it took;
+    // a give-up leaves 'b' and 'm' as they were, ready for the next run
+    unsigned long long limit=s->bound.limit;
+    for(unsigned long long k=1;;k++){
+        unsigned long long run=s->nodes+luby(k)*RESTART_UNIT;
+        s->bound.limit = limit && limit<run ? limit : run;
+        s->bound.gave_up=false;
+        bool ok=solve_rec(b,&m,s);
+        s->bound.limit=limit;
+        if(ok || !s->bound.gave_up) return ok;
+        if(s->nodes<=run || (limit && s->nodes>limit)) return false;   // the caller's bounds
+        s->restarts++;
+    }
+}
+
+static inline bool solve_board(Board* b){
+    Search s={0};
+    return search_solve(b,&s);
+}
+
+/* ------------------------- Rule checks ------------------------- */
+
+// Cell i of LANE_COUNT boards sits in one LaneVec, one board per 16-bit
+// lane; the batch solver in sudoku.c uses the same layout.
+#define LANE_COUNT 8
+typedef uint16_t LaneVec __attribute__((vector_size(2*LANE_COUNT)));
+
+static inline int unit_cell(int u, int j){
+    if(u<N) return u*N+j;                                   // row u
+    if(u<2*N) return j*N+(u-N);                             // column u-9
+    int b=u-2*N;                                            // box u-18
+    return (b/3*3+j/3)*N + b%3*3+j%3;
+}
+
+// Boards are checked LANE_COUNT at a time in the same layout as the batch
+// solver: every unit is folded into seen/duplicate digit masks with vector
+// ORs and ANDs, so one pass over the 27 units gives every lane's verdict.
+typedef enum { CHECK_SOLVED, CHECK_OPEN, CHECK_CONFLICT, CHECK_MALFORMED } CheckResult;
+
+typedef struct {
+    uint8_t result;       // CheckResult
+    int8_t unit;          // first unit with a repeated digit: rows 0-8, columns 9-17, boxes 18-26; else -1
+} Verdict;
+
+#define CELL_EMPTY 0x8000u
+
+static void lane_check(const LaneVec* x, Verdict* out, int used){
+    LaneVec open={0}, bad={0}, first={0};
+    first += 3*N;                                  // 27 == no conflict yet
+    for(int i=0;i<N*N;i++){
+        open |= x[i];
+        bad |= (LaneVec)(x[i]==0);
+    }
+    for(int u=0;u<3*N;u++){
+        LaneVec seen={0}, dup={0};
+        for(int j=0;j<N;j++){
+            LaneVec v=x[unit_cell(u,j)];
+            dup |= seen & v;
+            seen |= v;
+        }
+        LaneVec take = (LaneVec)(first==3*N) & (LaneVec)((dup & ALL)!=0);
+        first = (take & (uint16_t)u) | (first & ~take);
+    }
+    for(int k=0;k<used;k++){
+        Verdict* v=&out[k];
+        v->unit=-1;
+        if(bad[k]) v->result=CHECK_MALFORMED;
+        else if(first[k]<3*N){ v->result=CHECK_CONFLICT; v->unit=(int8_t)first[k]; }
+        else v->result = (open[k] & CELL_EMPTY) ? CHECK_OPEN : CHECK_SOLVED;
+    }
+}
+
+// Verdicts for b[0..n).
+static void check_boards(const Board* b, size_t n, Verdict* out){
+    for(size_t base=0;base<n;base+=LANE_COUNT){
+        LaneVec x[N*N]={{0}};
+        int used = n-base < LANE_COUNT ? (int)(n-base) : LANE_COUNT;
+        for(int k=0;k<used;k++)
+            for(int i=0;i<N*N;i++){
+                int v=b[base+(size_t)k].grid[i/N][i%N];
+                x[i][k] = v ? (uint16_t)(1u<<(v-1)) : CELL_EMPTY;
+            }
+        lane_check(x,out+base,used);
+    }
+}
+
+static bool is_legal(const Board* b){
+    Verdict v;
+    check_boards(b,1,&v);
+    return v.result!=CHECK_CONFLICT;
+}
+
+/* ---------------------- Generator utilities ---------------------- */
+
+static const uint8_t perm3[6][3] = {{0,1,2},{0,2,1},{1,0,2},{1,2,0},{2,0,1},{2,1,0}};
+
+static void base_complete(Board* b){
+    // Standard Latin base pattern: value = (r*3 + r/3 + c) % 9 + 1
+    for(int r=0;r<N;r++)
+        for(int c=0;c<N;c++)
+            b->grid[r][c] = ( (r*3 + r/3 + c) % 9 ) + 1;
+}
+
+static void shuffle_array(int *a, int n, Rng* g){
+    for(int i=n-1;i>0;i--){
+        int j = (int)(rng_next(g)%(uint64_t)(i+1));
+        int t=a[i]; a[i]=a[j]; a[j]=t;
+    }
+}
+
+// Every isomorph of a grid is one transform: a digit renaming, an order of
+// the bands and of the rows inside each band, the same for stacks and
+// columns, and an optional transpose. Transforms are numbered from 0 (the
+// identity) to TRANSFORM_COUNT-1 with the digit renaming varying fastest,
+// so runs of DIGIT_PERMS consecutive indices share one cell layout.
+#define DIGIT_PERMS 362880ull                  // 9!
+#define LAYOUTS (6ull*216*6*216*2)             // bands, rows, stacks, columns, transpose
+#define TRANSFORM_COUNT (DIGIT_PERMS*LAYOUTS)
+
+typedef struct {
+    uint8_t src[N*N];    // output cell i is input cell src[i]
+    uint8_t digit[N+1];  // input digit d becomes digit[d]; digit[0]==0
+} Transform;
+
+// Digit renaming number k (0..DIGIT_PERMS-1) in lexicographic order.
+static void transform_digits(uint64_t k, uint8_t digit[N+1]){
+    uint8_t left[N];
+    for(int i=0;i<N;i++) left[i]=(uint8_t)(i+1);
+    uint64_t f=DIGIT_PERMS;
+    digit[0]=0;
+    for(int i=0;i<N;i++){
+        f/=(uint64_t)(N-i);
+        int j=(int)(k/f); k%=f;
+        digit[i+1]=left[j];
+        memmove(&left[j],&left[j+1],(size_t)(N-1-i-j));
+    }
+}
+
+// Gather table of cell layout number k (0..LAYOUTS-1).
+static void transform_layout(uint64_t k, uint8_t src[N*N]){
+    bool transpose=k%2; k/=2;
+    int cols=(int)(k%216); k/=216;
+    int stacks=(int)(k%6); k/=6;
+    int rows=(int)(k%216); k/=216;
+    int bands=(int)k;
+    int rp[3]={rows%6, rows/6%6, rows/36}, cp[3]={cols%6, cols/6%6, cols/36};
+    uint8_t rmap[N], cmap[N];
+    for(int i=0;i<3;i++) for(int j=0;j<3;j++){
+        rmap[3*i+j]=(uint8_t)(3*perm3[bands][i]+perm3[rp[i]][j]);
+        cmap[3*i+j]=(uint8_t)(3*perm3[stacks][i]+perm3[cp[i]][j]);
+    }
+    for(int r=0;r<N;r++) for(int c=0;c<N;c++)
+        src[r*N+c] = transpose ? (uint8_t)(rmap[c]*N+cmap[r]) : (uint8_t)(rmap[r]*N+cmap[c]);
+}
+
+static void transform_from_index(uint64_t idx, Transform* t){
+    transform_layout(idx/DIGIT_PERMS, t->src);
+    transform_digits(idx%DIGIT_PERMS, t->digit);
+}
+
+// out = t(in); 'out' must not alias 'in'.
+static void transform_apply(const Transform* t, const Board* in, Board* out){
+    for(int i=0;i<N*N;i++){
+        int s=t->src[i];
+        out->grid[i/N][i%N]=t->digit[in->grid[s/N][s%N]];
+    }
+}
+
+typedef enum { DIFF_EASY, DIFF_MEDIUM, DIFF_HARD } Difficulty;   // sudoku_level order
+
+static int target_clues(Difficulty d){
+    switch(d){
+        case DIFF_EASY: return 45;   // easier: more givens
+        case DIFF_MEDIUM: return 36;
+        case DIFF_HARD: return 27;   // harder: fewer givens
+        default: return 36;
+    }
+}
+
+static void generate_complete(Board* sol, Rng* g){
+    TRACE_SCOPE("complete grid");
+    Board base;
+    base_complete(&base);
+    Transform t;
+    transform_from_index(rng_next(g)%TRANSFORM_COUNT,&t);
+    transform_apply(&t,&base,sol);
+}
+
+// Make a puzzle from a complete solution by removing symmetric pairs,
+// ensuring uniqueness via solution counting (up to 2). Once 'bound'
+// (optional) is out, removal stops: the puzzle so far is unique already.
+static void make_puzzle(const Board* solution, Board* puzzle, Difficulty d, Rng* g, Bounds* bound){
+    TRACE_SCOPE("make_puzzle");
+    copy_board(puzzle, solution);
+    int target = target_clues(d);
+    int clues = N*N;
+
+    int cells[N*N];
+    for(int i=0;i<N*N;i++) cells[i]=i;
+    shuffle_array(cells,N*N,g);
+
+    int attempts = 0;
+    for(int idx=0; idx<N*N && clues>target; idx++){
+        TRACE_SCOPE("removal");
+        int i=cells[idx];
+        int r=i/9, c=i%9;
+        int sr=8-r, sc=8-c; // symmetric cell
+        if(puzzle->grid[r][c]==0) continue;
+
+        // Try removing one or the symmetric pair
+        int removed=0;
+        Board test; copy_board(&test,puzzle);
+        test.grid[r][c]=0; removed++;
+        if(!(sr==r && sc==c) && test.grid[sr][sc]!=0){ test.grid[sr][sc]=0; removed++; }
+
+        // the known solution's digits first: an ambiguous board shows its
+        // second solution soonest after the first (measured ~15% faster
+        // than 1 up, p99 -30%); the count, hence the puzzle, is the same
+        int sols = count_ordered(&test,2,NULL,ORDER_GUIDED,solution,bound,NULL);
+        if(bound && bound->gave_up) break;      // one solution found, the second unrefuted
+        if(sols==1){
+            puzzle->grid[r][c]=0;
+            if(!(sr==r && sc==c)) puzzle->grid[sr][sc]=0;
+            clues -= removed;
+        }
+        attempts++;
+        if(attempts>20000) break; // safety cap
+    }
+}
+
+/* ------------------------- Latency histograms ------------------------- */
+
+// Log-linear, HDR style: below 2*LAT_SUB ns every value has its own bucket,
+// above that each power of two is split into LAT_SUB buckets, so a value
+// is off by at most 1/LAT_SUB (1.6%) anywhere from nanoseconds to years, in
+// a fixed 30 KiB. One thread records (relaxed loads and stores, no locked
+// instructions); any other may read a consistent-enough snapshot meanwhile.
+#define LAT_SUB_BITS 6
+#define LAT_SUB (1<<LAT_SUB_BITS)
+#define LAT_BUCKETS (2*LAT_SUB + (63-LAT_SUB_BITS)*LAT_SUB)
+
+typedef struct {
+    _Atomic uint64_t count[LAT_BUCKETS];
+    _Atomic uint64_t calls, max;
+} LatHist;
+
+static inline uint64_t lat_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline int lat_index(uint64_t v){
+    if(v<2*LAT_SUB) return (int)v;
+    int shift=63-__builtin_clzll(v)-LAT_SUB_BITS;         // >= 1
+    return 2*LAT_SUB + (shift-1)*LAT_SUB + (int)(v>>shift) - LAT_SUB;
+}
+
+// Largest value that lands in bucket i.
+static uint64_t lat_ceiling(int i){
+    if(i<2*LAT_SUB) return (uint64_t)i;
+    int shift=(i-2*LAT_SUB)/LAT_SUB+1;
+    uint64_t low=(uint64_t)(LAT_SUB+(i-2*LAT_SUB)%LAT_SUB)<<shift;
+    return low+((uint64_t)1<<shift)-1;
+}
+
+static inline void lat_bump(_Atomic uint64_t* x, uint64_t by){
+    atomic_store_explicit(x,atomic_load_explicit(x,memory_order_relaxed)+by,memory_order_relaxed);
+}
+
+static inline void lat_record(LatHist* h, uint64_t ns){
+    lat_bump(&h->count[lat_index(ns)],1);
+    lat_bump(&h->calls,1);
+    if(ns>atomic_load_explicit(&h->max,memory_order_relaxed))
+        atomic_store_explicit(&h->max,ns,memory_order_relaxed);
+}
+
+// The value at quantile q (0..1): the ceiling of the bucket holding it,
+// capped by the largest value seen. 0 when empty.
+static uint64_t lat_quantile(const LatHist* h, double q){
+    uint64_t total=0;
+    for(int i=0;i<LAT_BUCKETS;i++) total+=atomic_load_explicit(&h->count[i],memory_order_relaxed);
+    uint64_t max=atomic_load_explicit(&h->max,memory_order_relaxed);
+    if(!total) return 0;
+    if(q>=1) return max;
+    uint64_t rank=(uint64_t)(q*(double)total), seen=0;
+    if(!rank || (double)rank<q*(double)total) rank++;
+    for(int i=0;i<LAT_BUCKETS;i++){
+        seen+=atomic_load_explicit(&h->count[i],memory_order_relaxed);
+        if(seen>=rank){
+            uint64_t v=lat_ceiling(i);
+            return v<max ? v : max;
+        }
+    }
+    return max;
+}
+
+/* --------------------------- Public API --------------------------- */
+
+_Static_assert((int)CHECK_MALFORMED==(int)SUDOKU_MALFORMED && (int)DIFF_HARD==(int)SUDOKU_HARD,
+               "internal enums follow sudoku.h");
+
+struct sudoku_ctx {
+    Rng rng;
+    Rng search_rng;          // randomized restarts, apart from generation
+    sudoku_search search;
+    TransTable tt;           // allocated by the first count that can use it
+    LatHist lat[SUDOKU_OPS]; // recorded by the owning thread only
+};
+
+#define CTX_TT_BYTES (16u<<20)
+
+// False if a cell is outside 0..9.
+static bool board_from_cells(Board* b, const uint8_t cell[N*N]){
+    int* g=&b->grid[0][0];
+    for(int i=0;i<N*N;i++){
+        if(cell[i]>N) return false;
+        g[i]=cell[i];
+    }
+    return true;
+}
+
+static void board_to_cells(const Board* b, uint8_t cell[N*N]){
+    const int* g=&b->grid[0][0];
+    for(int i=0;i<N*N;i++) cell[i]=(uint8_t)g[i];
+}
+
+sudoku_ctx* sudoku_new(uint64_t seed){
+    sudoku_ctx* ctx=calloc(1,sizeof *ctx);
+    if(ctx) sudoku_seed(ctx,seed);
+    return ctx;
+}
+
+void sudoku_free(sudoku_ctx* ctx){
+    if(!ctx) return;
+    tt_free(&ctx->tt);
+    free(ctx);
+}
+
+void sudoku_seed(sudoku_ctx* ctx, uint64_t seed){
+    ctx->rng.s=seed;
+    ctx->search_rng.s=mix64(seed);
+}
+
+void sudoku_set_search(sudoku_ctx* ctx, sudoku_search search){
+    ctx->search=search;
+}
+
+int sudoku_solve(sudoku_ctx* ctx, const uint8_t grid[81], uint8_t out[81]){
+    return sudoku_solve_budget(ctx,grid,out,NULL,NULL);
+}
+
+int sudoku_count(sudoku_ctx* ctx, const uint8_t grid[81], int limit){
+    return sudoku_count_budget(ctx,grid,limit,NULL,NULL);
+}
+
+// 'budget' as Bounds, the deadline counted from 't0'.
+static Bounds budget_bounds(const sudoku_budget* budget, uint64_t t0){
+    Bounds bd={0};
+    if(budget){
+        bd.limit=budget->max_nodes;
+        bd.deadline = budget->time_ns ? t0+budget->time_ns : 0;
+        bd.cancel=budget->cancel;
+    }
+    return bd;
+}
+
+int sudoku_solve_budget(sudoku_ctx* ctx, const uint8_t grid[81], uint8_t out[81],
+                        const sudoku_budget* budget, sudoku_stats* stats){
+    Board b;
+    if(stats) *stats=(sudoku_stats){0};
+    if(!board_from_cells(&b,grid)) return -1;
+    uint64_t t0=lat_now();
+    Search s={ .order = ctx->search==SUDOKU_SEARCH_LCV ? ORDER_LCV : ORDER_ASCENDING,
+               .bound=budget_bounds(budget,t0) };
+    if(ctx->search==SUDOKU_SEARCH_RESTARTS){ s.rng=&ctx->search_rng; s.restart=true; }
+    // searches poll every SEARCH_POLL+1 nodes: catch a budget spent already
+    bool ok=is_legal(&b) && !bounds_check(&s.bound) && search_solve(&b,&s);
+    uint64_t ns=lat_now()-t0;
+    lat_record(&ctx->lat[SUDOKU_OP_SOLVE],ns);
+    if(stats) *stats=(sudoku_stats){ s.nodes, ns, ok };
+    if(!ok) return s.bound.gave_up ? SUDOKU_GAVE_UP : 0;
+    board_to_cells(&b,out);
+    return 1;
+}
+
+int sudoku_count_budget(sudoku_ctx* ctx, const uint8_t grid[81], int limit,
+                        const sudoku_budget* budget, sudoku_stats* stats){
+    Board b;
+    if(stats) *stats=(sudoku_stats){0};
+    if(!board_from_cells(&b,grid)) return -1;
+    if(limit<=0 || !is_legal(&b)) return 0;
+    if(limit>=TT_MIN_LIMIT && !ctx->tt.e) tt_init(&ctx->tt,CTX_TT_BYTES);
+    uint64_t t0=lat_now();
+    Bounds bd=budget_bounds(budget,t0);
+    SolverStats st={0};
+    int n = bounds_check(&bd) ? 0
+          : count_ordered(&b,limit,ctx->tt.e ? &ctx->tt : NULL,ORDER_ASCENDING,NULL,budget ? &bd : NULL,&st);
+    uint64_t ns=lat_now()-t0;
+    lat_record(&ctx->lat[SUDOKU_OP_COUNT],ns);
+    if(stats) *stats=(sudoku_stats){ st.nodes, ns, n };
+    return bd.gave_up ? SUDOKU_GAVE_UP : n;
+}
+
+int sudoku_generate(sudoku_ctx* ctx, sudoku_level level, uint8_t puzzle[81], uint8_t solution[81]){
+    return sudoku_generate_best(ctx,level,NULL,puzzle,solution);
+}
+
+static int count_givens(const Board* b){
+    int n=0;
+    for(int r=0;r<N;r++) for(int c=0;c<N;c++) n+=b->grid[r][c]!=0;
+    return n;
+}
+
+// Search nodes to solve and prove unique, as sudoku_rate.
+static long long puzzle_rating(const Board* puzzle){
+    Board b=*puzzle;
+    SolverStats st={0};
+    count_solutions_ex(&b,2,NULL,&st);
+    return (long long)st.nodes;
+}
+
+// Whether a puzzle of 'clues' givens and 'rating' beats the best so far
+// for level 'd': fewer givens first, then a higher rating for hard and a
+// lower one for easy.
+static bool puzzle_better(Difficulty d, int clues, long long rating, int best_clues, long long best_rating){
+    if(clues!=best_clues) return clues<best_clues;
+    return d==DIFF_HARD ? rating>best_rating : d==DIFF_EASY && rating<best_rating;
+}
+
+int sudoku_generate_best(sudoku_ctx* ctx, sudoku_level level, const sudoku_budget* budget,
+                         uint8_t puzzle[81], uint8_t solution[81]){
+    TRACE_SCOPE("generate");
+    Difficulty d=(Difficulty)level;
+    Bounds bd=budget_bounds(budget,lat_now());
+    bd.limit=0;                      // per uniqueness check, it would end the run at the first
+    // unbounded or spent already, one unbounded attempt is all
+    bool more = (bd.deadline || bd.cancel) && !bounds_check(&bd);
+    Board best, best_sol;
+    int best_clues=N*N+1;
+    long long best_rating=-1;        // rated lazily, at the first tie
+    do{
+        Board sol, puz;
+        uint64_t t0=lat_now();
+        generate_complete(&sol,&ctx->rng);
+        uint64_t t1=lat_now();
+        make_puzzle(&sol,&puz,d,&ctx->rng,more ? &bd : NULL);
+        lat_record(&ctx->lat[SUDOKU_OP_COMPLETE],t1-t0);
+        lat_record(&ctx->lat[SUDOKU_OP_PUZZLE],lat_now()-t1);
+        int clues=count_givens(&puz);
+        long long rating=-1;
+        if(clues==best_clues && d!=DIFF_MEDIUM){   // ratings only break ties
+            rating=puzzle_rating(&puz);
+            if(best_rating<0) best_rating=puzzle_rating(&best);
+        }
+        if(puzzle_better(d,clues,rating,best_clues,best_rating)){
+            best=puz; best_sol=sol;
+            best_clues=clues; best_rating=rating;
+        }
+    } while(more && best_clues>target_clues(d) && !bounds_check(&bd));
+    board_to_cells(&best,puzzle);
+    if(solution) board_to_cells(&best_sol,solution);
+    return best_clues;
+}
+
+// Whether givens on 'mask' can make a unique puzzle at all: 17 at least,
+// and no two rows of a band (or columns of a stack) without any, as
+// swapping those would give a second solution.
+static bool pattern_possible(const uint8_t mask[N*N]){
+    int n=0;
+    unsigned rows=0, cols=0;
+    for(int i=0;i<N*N;i++)
+        if(mask[i]){ n++; rows|=1u<<(i/N); cols|=1u<<(i%N); }
+    if(n<17) return false;
+    for(int b=0;b<BOX;b++){
+        unsigned band=7u<<(b*BOX);
+        if(popcount9(band&~rows)>1 || popcount9(band&~cols)>1) return false;
+    }
+    return true;
+}
+
+// A puzzle with givens exactly on 'mask', by local search. The givens 'p'
+// always keep a known solution 'a'. Solving with a's digits tried last
+// finds another solution 'b' if there is one (reaching 'a' first proves it
+// unique); where the two differ is a set of cells one of which must become
+// a given. Taking a cell of that set on the mask, with a's digit or b's,
+// rules the other grid out. A set that misses the mask dooms both grids
+// whatever the remaining givens, so rather than search on below them, one
+// given is dropped and 'a' is redrawn among the solutions left. Returns 1,
+// or SUDOKU_GAVE_UP when 'bd' is out.
+static int pattern_search(const uint8_t mask[N*N], Rng* g, Bounds* bd, Board* puzzle, Board* solution){
+    Board p={0}, a, b;
+    for(bool draw=true;;){
+        Search s={ .rng=g, .bound=*bd };
+        if(draw){
+            a=p;
+            if(!search_solve(&a,&s)) break;         // 'p' has solutions: only the bound fails
+            draw=false;
+        }
+        b=p;
+        s=(Search){ .order=ORDER_AVOID, .guide=&a, .singles=true, .bound=*bd };   // singles: 15x fewer nodes
+        if(!search_solve(&b,&s)) break;
+        if(memcmp(&a,&b,sizeof a)==0){
+            for(int i=0;i<N*N;i++)          // the rest of the mask, forced by now
+                if(mask[i]) p.grid[i/N][i%N]=a.grid[i/N][i%N];
+            *puzzle=p; *solution=a;
+            return 1;
+        }
+        int diff[N*N], k=0, given[N*N], n=0;
+        for(int i=0;i<N*N;i++){
+            if(p.grid[i/N][i%N]) given[n++]=i;
+            else if(mask[i] && a.grid[i/N][i%N]!=b.grid[i/N][i%N]) diff[k++]=i;
+        }
+        if(k){
+            int i=diff[rng_next(g)%k];
+            if(rng_next(g)&1) a=b;
+            p.grid[i/N][i%N]=a.grid[i/N][i%N];
+        } else {
+            if(n){ int i=given[rng_next(g)%n]; p.grid[i/N][i%N]=0; }
+            draw=true;
+        }
+    }
+    bd->gave_up=true;
+    return SUDOKU_GAVE_UP;
+}
+
+int sudoku_generate_pattern(sudoku_ctx* ctx, const uint8_t mask[81], const sudoku_budget* budget,
+                            uint8_t puzzle[81], uint8_t solution[81]){
+    TRACE_SCOPE("generate pattern");
+    if(!pattern_possible(mask)) return 0;
+    Bounds bd=budget_bounds(budget,lat_now());
+    bd.limit=0;                      // time and cancel only, as sudoku_generate_best
+    Board puz, sol;
+    if(bounds_check(&bd) || pattern_search(mask,&ctx->rng,&bd,&puz,&sol)!=1) return SUDOKU_GAVE_UP;
+    board_to_cells(&puz,puzzle);
+    if(solution) board_to_cells(&sol,solution);
+    return count_givens(&puz);
+}
+
+long long sudoku_rate(sudoku_ctx* ctx, const uint8_t puzzle[81]){
+    (void)ctx;
+    Board b;
+    if(!board_from_cells(&b,puzzle) || !is_legal(&b)) return -1;
+    SolverStats st={0};
+    if(count_solutions_ex(&b,2,NULL,&st)!=1) return -1;
+    return (long long)st.nodes;
+}
+
+sudoku_check sudoku_validate(const uint8_t grid[81], int* unit){
+    Board b;
+    Verdict v={ CHECK_MALFORMED, -1 };
+    if(board_from_cells(&b,grid)) check_boards(&b,1,&v);
+    if(unit) *unit=v.unit;
+    return (sudoku_check)v.result;
+}
+
+uint64_t sudoku_latency(const sudoku_ctx* ctx, sudoku_op op, double q){
+    return (unsigned)op<SUDOKU_OPS ? lat_quantile(&ctx->lat[op],q) : 0;
+}
+
+uint64_t sudoku_calls(const sudoku_ctx* ctx, sudoku_op op){
+    return (unsigned)op<SUDOKU_OPS ? atomic_load_explicit(&ctx->lat[op].calls,memory_order_relaxed) : 0;
+}
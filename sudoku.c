@@ -1,8 +1,12 @@
-// sudoku.c - single-file, single-thread terminal Sudoku game
-// Build: gcc -std=c2x -O2 -Wall -Wextra -o sudoku sudoku.c
+// sudoku.c - terminal Sudoku game plus batch tools, on top of libsudoku
+// Build: gcc -std=c2x -O2 -Wall -Wextra -pthread -o sudoku sudoku.c
+// (libsudoku.c and sudoku.h must sit next to it), or use CMakeLists.txt.
 // (Use -std=c23 if your GCC prefers the finalized name.)
 // Copyright 2025. Bogdan Drozdov. All rights reserved.
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE             // syscall, for perf_event_open
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -10,438 +14,4585 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/* ------------------------- Tracing ------------------------- */
+
+// Phase tracing for 'sudoku -T FILE ...'. TRACE_SCOPE("name") times the
+// rest of the enclosing block as one Chrome trace "complete" event. Events
+// go to chunks owned by the recording thread; a thread takes the lock
+// once, to register itself. When the mode returns, trace_write dumps
+// every thread's events as trace-event JSON, for chrome://tracing or
+// ui.perfetto.dev. While tracing is off a scope is a load and a branch.
+// libsudoku.c picks up the same TRACE_SCOPE.
+#define TRACE_CHUNK 4096
+
+typedef struct {
+    const char* name;
+    uint64_t start, dur;         // ns
+} TraceEvent;
+
+typedef struct TraceChunk {
+    struct TraceChunk* next;
+    size_t n;
+    TraceEvent ev[TRACE_CHUNK];
+} TraceChunk;
+
+typedef struct TraceThread {
+    struct TraceThread* next;
+    int tid;
+    const char* name;
+    TraceChunk* chunks;          // newest first
+} TraceThread;
+
+typedef struct {
+    const char* name;
+    uint64_t start;              // 0: not tracing
+} TraceScope;
+
+static bool trace_on;
+static uint64_t trace_epoch;
+static pthread_mutex_t trace_lock=PTHREAD_MUTEX_INITIALIZER;
+static TraceThread* trace_threads;
+static _Thread_local TraceThread* trace_self;
+
+static inline uint64_t trace_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static TraceThread* trace_thread(void){
+    if(!trace_self && (trace_self=calloc(1,sizeof *trace_self))){
+        pthread_mutex_lock(&trace_lock);
+        trace_self->tid = trace_threads ? trace_threads->tid+1 : 1;
+        trace_self->next=trace_threads;
+        trace_threads=trace_self;
+        pthread_mutex_unlock(&trace_lock);
+    }
+    return trace_self;
+}
+
+// Names the calling thread's track ('name' must outlive the run).
+static void trace_name(const char* name){
+    TraceThread* t = trace_on ? trace_thread() : NULL;
+    if(t) t->name=name;
+}
+
+static inline TraceScope trace_begin(const char* name){
+    return (TraceScope){ name, trace_on ? trace_clock() : 0 };
+}
+
+static void trace_end(TraceScope* s){
+    if(!s->start) return;
+    uint64_t end=trace_clock();
+    TraceThread* t=trace_thread();
+    TraceChunk* c = t ? t->chunks : NULL;
+    if(t && (!c || c->n==TRACE_CHUNK) && (c=malloc(sizeof *c))){
+        c->n=0;
+        c->next=t->chunks;
+        t->chunks=c;
+    }
+    if(c) c->ev[c->n++]=(TraceEvent){ s->name, s->start, end-s->start };
+}
+
+#define TRACE_JOIN(a,b) a##b
+#define TRACE_VAR(line) TRACE_JOIN(trace_scope_,line)
+#define TRACE_SCOPE(name) \
+    TraceScope TRACE_VAR(__LINE__) __attribute__((cleanup(trace_end))) = trace_begin(name)
+
+static void trace_start(void){
+    trace_epoch=trace_clock()-1;
+    trace_on=true;
+    trace_name("main");
+}
+
+// Writes all events to 'path' and frees them; call once the other threads
+// are joined.
+static bool trace_write(const char* path){
+    trace_on=false;
+    FILE* f=fopen(path,"w");
+    if(!f){ perror(path); return false; }
+    unsigned long long events=0;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n",f);
+    const char* sep="";
+    while(trace_threads){
+        TraceThread* t=trace_threads;
+        trace_threads=t->next;
+        if(t->name){
+            fprintf(f,"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    sep, t->tid, t->name);
+            sep=",\n";
+        }
+        while(t->chunks){
+            TraceChunk* c=t->chunks;
+            t->chunks=c->next;
+            for(size_t i=0;i<c->n;i++){
+                const TraceEvent* e=&c->ev[i];
+                fprintf(f,"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        sep, e->name, t->tid, (double)(e->start-trace_epoch)/1e3, (double)e->dur/1e3);
+                sep=",\n";
+            }
+            events+=c->n;
+            free(c);
+        }
+        free(t);
+    }
+    trace_self=NULL;
+    fputs("\n]}\n",f);
+    bool ok = !ferror(f);
+    if(fclose(f)!=0) ok=false;
+    if(!ok) perror(path);
+    else fprintf(stderr,"trace: %llu events in %s\n", events, path);
+    return ok;
+}
+
+// The engine is compiled in rather than linked: the batch modes below
+// work on its boards, masks and kernels directly. The game itself only
+// goes through the public API in sudoku.h.
+#include "libsudoku.c"
+
+// Row, column and box of each cell index 0..80.
+static const uint8_t cell_row[N*N] = {
+    0,0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1,1, 2,2,2,2,2,2,2,2,2,
+    3,3,3,3,3,3,3,3,3, 4,4,4,4,4,4,4,4,4, 5,5,5,5,5,5,5,5,5,
+    6,6,6,6,6,6,6,6,6, 7,7,7,7,7,7,7,7,7, 8,8,8,8,8,8,8,8,8 };
+static const uint8_t cell_col[N*N] = {
+    0,1,2,3,4,5,6,7,8, 0,1,2,3,4,5,6,7,8, 0,1,2,3,4,5,6,7,8,
+    0,1,2,3,4,5,6,7,8, 0,1,2,3,4,5,6,7,8, 0,1,2,3,4,5,6,7,8,
+    0,1,2,3,4,5,6,7,8, 0,1,2,3,4,5,6,7,8, 0,1,2,3,4,5,6,7,8 };
+static const uint8_t cell_box[N*N] = {
+    0,0,0,1,1,1,2,2,2, 0,0,0,1,1,1,2,2,2, 0,0,0,1,1,1,2,2,2,
+    3,3,3,4,4,4,5,5,5, 3,3,3,4,4,4,5,5,5, 3,3,3,4,4,4,5,5,5,
+    6,6,6,7,7,7,8,8,8, 6,6,6,7,7,7,8,8,8, 6,6,6,7,7,7,8,8,8 };
+
+// Whole board formatted into one buffer and written with a single fputs.
+static void print_board(const Board* b){
+    static const char rule[]="  +-------+-------+-------+\n";
+    char out[512];
+    char* o=out;
+    o+=sprintf(o,"    1 2 3   4 5 6   7 8 9\n%s", rule);
+    for(int r=0;r<N;r++){
+        *o++=(char)('1'+r); *o++=' '; *o++='|';
+        for(int c=0;c<N;c++){
+            int v=b->grid[r][c];
+            *o++=' ';
+            *o++ = v ? (char)('0'+v) : '.';
+            if((c+1)%3==0){ *o++=' '; *o++='|'; }
+        }
+        *o++='\n';
+        if((r+1)%3==0){ memcpy(o,rule,sizeof rule-1); o+=sizeof rule-1; }
+    }
+    *o=0;
+    fputs(out,stdout);
+}
+
+/* ------------------------- Batch solving ------------------------- */
+
+// Puzzles are solved up to 32 at a time in structure-of-arrays form: cell i
+// of eight puzzles sits in one LaneVec, one puzzle per 16-bit lane, and a
+// batch of 8, 16 or 32 puzzles is one, two or four such groups. All lanes
+// run the same naked/hidden single propagation with no per-puzzle branches;
+// only lanes left with open cells go on to solve_board.
+#define MAX_LANE_GROUPS 4
+
+typedef struct {
+    unsigned long long puzzles;
+    unsigned long long propagated;    // solved by propagation alone
+    unsigned long long searched;      // needed the scalar search
+    unsigned long long unsolvable;
+    unsigned long long cached;        // answered by the solution cache
+} BatchStats;
+
+static inline LaneVec lane_single(LaneVec x){
+    return x & (LaneVec)((x & (x-1))==0);    // the bit if exactly one is set, else 0
+}
+
+static inline bool lane_any(LaneVec v){
+    for(int k=0;k<LANE_COUNT;k++) if(v[k]) return true;
+    return false;
+}
+
+// One propagation pass over groups [0,ng). Dead lanes (a cell with no
+// candidate, a digit twice or nowhere in a unit, a cell that is the only
+// place for two digits) get all ones in dead[]. Returns whether any live
+// lane changed.
+static bool lane_pass(LaneVec (*x)[MAX_LANE_GROUPS], LaneVec* dead, int ng){
+    LaneVec fixed[N*N][MAX_LANE_GROUPS], seen[3*N][MAX_LANE_GROUPS];
+    LaneVec changed[MAX_LANE_GROUPS];
+    for(int g=0;g<ng;g++) changed[g]=(LaneVec){0};
+
+    for(int i=0;i<N*N;i++)
+        for(int g=0;g<ng;g++){
+            fixed[i][g]=lane_single(x[i][g]);
+            dead[g] |= (LaneVec)(x[i][g]==0);
+        }
+    // naked singles: drop every placed digit from the rest of its units
+    for(int u=0;u<3*N;u++){
+        for(int g=0;g<ng;g++) seen[u][g]=(LaneVec){0};
+        for(int j=0;j<N;j++){
+            int i=unit_cell(u,j);
+            for(int g=0;g<ng;g++){
+                dead[g] |= (LaneVec)((seen[u][g] & fixed[i][g])!=0);
+                seen[u][g] |= fixed[i][g];
+            }
+        }
+    }
+    for(int i=0;i<N*N;i++){
+        const LaneVec* r=seen[cell_row[i]];
+        const LaneVec* c=seen[N+cell_col[i]];
+        const LaneVec* b=seen[2*N+cell_box[i]];
+        for(int g=0;g<ng;g++){
+            LaneVec nx = x[i][g] & ~((r[g]|c[g]|b[g]) ^ fixed[i][g]);
+            changed[g] |= (LaneVec)(nx!=x[i][g]);
+            x[i][g]=nx;
+        }
+    }
+    // hidden singles: a digit with one place left in a unit goes there
+    for(int u=0;u<3*N;u++){
+        LaneVec once[MAX_LANE_GROUPS], twice[MAX_LANE_GROUPS];
+        for(int g=0;g<ng;g++) once[g]=twice[g]=(LaneVec){0};
+        for(int j=0;j<N;j++){
+            int i=unit_cell(u,j);
+            for(int g=0;g<ng;g++){
+                twice[g] |= once[g] & x[i][g];
+                once[g] |= x[i][g];
+            }
+        }
+        for(int g=0;g<ng;g++){
+            dead[g] |= (LaneVec)(once[g]!=ALL);
+            once[g] &= ~twice[g];
+        }
+        for(int j=0;j<N;j++){
+            int i=unit_cell(u,j);
+            for(int g=0;g<ng;g++){
+                LaneVec t = x[i][g] & once[g];
+                LaneVec hit = (LaneVec)(t!=0);
+                dead[g] |= (LaneVec)((t & (t-1))!=0);
+                LaneVec nx = (t & hit) | (x[i][g] & ~hit);
+                changed[g] |= (LaneVec)(nx!=x[i][g]);
+                x[i][g]=nx;
+            }
+        }
+    }
+    bool any=false;
+    for(int g=0;g<ng;g++) any |= lane_any(changed[g] & ~dead[g]);
+    return any;
+}
+
+// Solves b[0..n) in place, 'lanes' (8, 16 or 32) puzzles per batch;
+// solved[i] tells whether b[i] had a solution (unsolvable boards are left
+// as they were). 'st' (optional) accumulates.
+static void solve_batch(Board* b, bool* solved, size_t n, int lanes, BatchStats* st){
+    int ng = lanes>=32 ? 4 : lanes>=16 ? 2 : 1;
+    int width=ng*LANE_COUNT;
+    BatchStats local={0};
+    for(size_t base=0;base<n;base+=(size_t)width){
+        LaneVec x[N*N][MAX_LANE_GROUPS], dead[MAX_LANE_GROUPS];
+        int used = n-base < (size_t)width ? (int)(n-base) : width;
+        for(int g=0;g<ng;g++) dead[g]=(LaneVec){0};
+        for(int i=0;i<N*N;i++)
+            for(int l=0;l<width;l++){
+                // spare lanes copy the last puzzle so they cost nothing extra to converge
+                const Board* p=&b[base + (size_t)(l<used ? l : used-1)];
+                int v=p->grid[i/N][i%N];
+                x[i][l/LANE_COUNT][l%LANE_COUNT] = v ? (uint16_t)(1u<<(v-1)) : ALL;
+            }
+        while(lane_pass(x,dead,ng)) {}
+
+        for(int l=0;l<used;l++){
+            int g=l/LANE_COUNT, k=l%LANE_COUNT;
+            Board q;
+            bool open=false;
+            for(int i=0;i<N*N;i++){
+                unsigned m=x[i][g][k];
+                if(m && !(m&(m-1))) q.grid[i/N][i%N]=lsb_index(m)+1;
+                else { q.grid[i/N][i%N]=0; open=true; }
+            }
+            bool ok;
+            if(dead[g][k]) ok=false;
+            else if(!open){ ok=true; local.propagated++; }
+            else { ok=solve_board(&q); local.searched++; }
+            if(ok) b[base+(size_t)l]=q;
+            else local.unsolvable++;
+            solved[base+(size_t)l]=ok;
+        }
+    }
+    local.puzzles=n;
+    if(st){
+        st->puzzles += local.puzzles; st->propagated += local.propagated;
+        st->searched += local.searched; st->unsolvable += local.unsolvable;
+    }
+}
+
+/* ----------------------- Batch validation ----------------------- */
+
+// Cell bit of each input character: 1<<(d-1) for a digit d, CELL_EMPTY for
+// '.' or '0', and 0 for anything else (a malformed record).
+static const uint16_t char_bit[256] = {
+    ['1']=1<<0, ['2']=1<<1, ['3']=1<<2, ['4']=1<<3, ['5']=1<<4,
+    ['6']=1<<5, ['7']=1<<6, ['8']=1<<7, ['9']=1<<8,
+    ['0']=CELL_EMPTY, ['.']=CELL_EMPTY,
+};
+
+#ifdef HAVE_X86_SIMD
+// In-lane 16x16 byte transpose: byte j of row r ends up as byte
+// transpose_order[r] of row j, in each 128-bit half.
+static const uint8_t transpose_order[16] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+
+__attribute__((target("avx2")))
+static void transpose16_avx2(__m256i m[16]){
+    __m256i t[16];
+    for(int i=0;i<8;i++){ t[2*i]=_mm256_unpacklo_epi8(m[i],m[i+8]); t[2*i+1]=_mm256_unpackhi_epi8(m[i],m[i+8]); }
+    for(int i=0;i<8;i++){ m[2*i]=_mm256_unpacklo_epi16(t[i],t[i+8]); m[2*i+1]=_mm256_unpackhi_epi16(t[i],t[i+8]); }
+    for(int i=0;i<8;i++){ t[2*i]=_mm256_unpacklo_epi32(m[i],m[i+8]); t[2*i+1]=_mm256_unpackhi_epi32(m[i],m[i+8]); }
+    for(int i=0;i<8;i++){ m[2*i]=_mm256_unpacklo_epi64(t[i],t[i+8]); m[2*i+1]=_mm256_unpackhi_epi64(t[i],t[i+8]); }
+}
+
+// 32 records straight from text: records j and j+16 share a vector, one per
+// 128-bit half, so the in-lane transpose yields cell-major bytes. Digits
+// 1-8 become bits through a pshufb table; 9s are counted per unit instead.
+__attribute__((target("avx2")))
+static void check32_avx2(const char* const* rec, Verdict* out){
+    __m256i bits[N*N], nine[N*N];
+    const __m256i zero=_mm256_setzero_si256(), ones=_mm256_set1_epi8(-1);
+    const __m256i ch0=_mm256_set1_epi8('0'), dot=_mm256_set1_epi8('.'), d9=_mm256_set1_epi8(9);
+    const __m256i tbl=_mm256_setr_epi8(0,1,2,4,8,16,32,64,-128,0,0,0,0,0,0,0,
+                                       0,1,2,4,8,16,32,64,-128,0,0,0,0,0,0,0);
+    __m256i ok=ones, open=zero;
+    for(int blk=0;blk*16<N*N;blk++){
+        __m256i m[16];
+        int w = N*N-blk*16 < 16 ? N*N-blk*16 : 16;
+        if(w==16){
+            for(int j=0;j<16;j++){
+                int r=transpose_order[j];
+                m[j]=_mm256_inserti128_si256(_mm256_castsi128_si256(
+                        _mm_loadu_si128((const __m128i*)(rec[r]+16*blk))),
+                        _mm_loadu_si128((const __m128i*)(rec[r+16]+16*blk)),1);
+            }
+            transpose16_avx2(m);
+        } else {
+            uint8_t tmp[16][32];
+            for(int j=0;j<w;j++) for(int k=0;k<32;k++) tmp[j][k]=(uint8_t)rec[k][16*blk+j];
+            for(int j=0;j<w;j++) m[j]=_mm256_loadu_si256((const __m256i*)tmp[j]);
+        }
+        for(int j=0;j<w;j++){
+            __m256i d=_mm256_sub_epi8(m[j],ch0);
+            __m256i dig=_mm256_cmpeq_epi8(_mm256_min_epu8(d,d9),d);
+            ok=_mm256_and_si256(ok,_mm256_or_si256(dig,_mm256_cmpeq_epi8(m[j],dot)));
+            d=_mm256_and_si256(d,dig);
+            open=_mm256_or_si256(open,_mm256_cmpeq_epi8(d,zero));
+            bits[16*blk+j]=_mm256_shuffle_epi8(tbl,d);
+            nine[16*blk+j]=_mm256_cmpeq_epi8(d,d9);
+        }
+    }
+    __m256i first=_mm256_set1_epi8(3*N);
+    const __m256i one=_mm256_set1_epi8(1);
+    for(int u=0;u<3*N;u++){
+        __m256i seen=zero, dup=zero, cnt=zero;
+        for(int j=0;j<N;j++){
+            int i=unit_cell(u,j);
+            dup=_mm256_or_si256(dup,_mm256_and_si256(seen,bits[i]));
+            seen=_mm256_or_si256(seen,bits[i]);
+            cnt=_mm256_sub_epi8(cnt,nine[i]);
+        }
+        __m256i bad=_mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(dup,zero),ones),
+                                    _mm256_cmpgt_epi8(cnt,one));
+        __m256i take=_mm256_and_si256(bad,_mm256_cmpeq_epi8(first,_mm256_set1_epi8(3*N)));
+        first=_mm256_blendv_epi8(first,_mm256_set1_epi8((char)u),take);
+    }
+    uint8_t f[32], k_ok[32], k_open[32];
+    _mm256_storeu_si256((__m256i*)f,first);
+    _mm256_storeu_si256((__m256i*)k_ok,ok);
+    _mm256_storeu_si256((__m256i*)k_open,open);
+    for(int k=0;k<32;k++){                      // byte k is record k
+        Verdict* v=&out[k];
+        v->unit=-1;
+        if(!k_ok[k]) v->result=CHECK_MALFORMED;
+        else if(f[k]<3*N){ v->result=CHECK_CONFLICT; v->unit=(int8_t)f[k]; }
+        else v->result = k_open[k] ? CHECK_OPEN : CHECK_SOLVED;
+    }
+}
+#endif
+
+// Verdicts for n 81-character records (no terminator needed).
+static void check_records(const char* const* rec, size_t n, Verdict* out){
+    size_t base=0;
+#ifdef HAVE_X86_SIMD
+    if(__builtin_cpu_supports("avx2"))
+        for(;base+32<=n;base+=32) check32_avx2(rec+base,out+base);
+#endif
+    for(;base<n;base+=LANE_COUNT){
+        LaneVec x[N*N]={{0}};
+        int used = n-base < LANE_COUNT ? (int)(n-base) : LANE_COUNT;
+        for(int k=0;k<used;k++){
+            const unsigned char* s=(const unsigned char*)rec[base+(size_t)k];
+            for(int i=0;i<N*N;i++) x[i][k]=char_bit[s[i]];
+        }
+        lane_check(x,out+base,used);
+    }
+}
+
+/* --------------------- Solution enumeration --------------------- */
+
+// Buffered output sink for the batch modes: one fwrite per WRITER_CAP bytes.
+#define WRITER_CAP (1u<<20)
+
+typedef struct {
+    FILE* f;
+    size_t len;
+    char* buf;            // WRITER_CAP bytes
+} Writer;
+
+static bool writer_open(Writer* w, FILE* f){
+    w->f=f; w->len=0;
+    w->buf=malloc(WRITER_CAP);
+    return w->buf!=NULL;
+}
+
+static void writer_flush(Writer* w){
+    TRACE_SCOPE("fwrite");
+    if(w->len){ fwrite(w->buf,1,w->len,w->f); w->len=0; }
+}
+
+static void writer_close(Writer* w){
+    writer_flush(w);
+    fflush(w->f);
+    free(w->buf); w->buf=NULL;
+}
+
+static inline void writer_put(Writer* w, const char* s, size_t n){
+    if(w->len+n > WRITER_CAP) writer_flush(w);
+    memcpy(w->buf+w->len, s, n);
+    w->len += n;
+}
+
+// Room for n bytes (n <= WRITER_CAP) to be formatted in place.
+static inline char* writer_space(Writer* w, size_t n){
+    if(w->len+n > WRITER_CAP) writer_flush(w);
+    char* p=w->buf+w->len;
+    w->len += n;
+    return p;
+}
+
+typedef struct {
+    Masks m;
+    uint8_t open[N*N];                // open[0..nopen) are the empty cells
+    int nopen;
+    unsigned long long found, limit;  // limit 0 == no cap
+    Writer* w;
+    char line[N*N+1];                 // current grid as text plus '\n'
+} Enumerator;
+
+// Depth-first walk over all completions; returns false once the cap is hit.
+// Each call first places naked singles in passes over the open-cell list,
+// then branches on the MRV cell; placements are undone from a local trail.
+static bool enum_rec(Enumerator* e){
+    uint8_t trail[N*N]; int nt=0;
+    int best=-1; unsigned bestMask=0;
+    bool dead=false;
+    for(bool placed=true; placed && !dead; ){
+        placed=false; best=-1; int bestCount=10;
+        for(int k=0;k<e->nopen;){
+            int p=e->open[k];
+            unsigned cand=(~(e->m.row[cell_row[p]] | e->m.col[cell_col[p]] | e->m.box[cell_box[p]])) & ALL;
+            int cnt=popcount9(cand);
+            if(cnt==0){ dead=true; break; }
+            if(cnt==1){
+                e->m.row[cell_row[p]]|=cand; e->m.col[cell_col[p]]|=cand; e->m.box[cell_box[p]]|=cand;
+                e->line[p]=(char)('1'+lsb_index(cand));
+                e->open[k]=e->open[--e->nopen];
+                e->open[e->nopen]=(uint8_t)p;
+                trail[nt++]=(uint8_t)p;
+                placed=true;
+                continue;
+            }
+            if(cnt<bestCount){ bestCount=cnt; bestMask=cand; best=k; }
+            k++;
+        }
+    }
+    bool go=true;
+    if(!dead){
+        if(e->nopen==0){
+            writer_put(e->w, e->line, sizeof e->line);
+            go = ++e->found != e->limit;
+        } else {
+            int p=e->open[best];
+            e->open[best]=e->open[--e->nopen];
+            e->open[e->nopen]=(uint8_t)p;
+            int r=cell_row[p], c=cell_col[p], bx=cell_box[p];
+            unsigned cand=bestMask;
+            while(cand && go){
+                unsigned bit=cand & -cand; cand ^= bit;
+                e->m.row[r]|=bit; e->m.col[c]|=bit; e->m.box[bx]|=bit;
+                e->line[p]=(char)('1'+lsb_index(bit));
+                go=enum_rec(e);
+                e->m.row[r]&=~bit; e->m.col[c]&=~bit; e->m.box[bx]&=~bit;
+            }
+            e->line[p]='.';
+            e->nopen++;
+        }
+    }
+    while(nt){
+        int p=trail[--nt];
+        unsigned bit=1u<<(e->line[p]-'1');
+        e->m.row[cell_row[p]]&=~bit; e->m.col[cell_col[p]]&=~bit; e->m.box[cell_box[p]]&=~bit;
+        e->line[p]='.';
+        e->nopen++;
+    }
+    return go;
+}
+
+// Stream every solution of 'b' (at most 'limit', 0 == all) to 'w' as
+// 81-character lines. Only the current search path is held in memory.
+static unsigned long long enumerate_solutions(const Board* b, unsigned long long limit, Writer* w){
+    Enumerator e;
+    masks_init(&e.m,b);
+    e.nopen=0; e.found=0; e.limit=limit; e.w=w;
+    for(int i=0;i<N*N;i++){
+        int v=b->grid[i/N][i%N];
+        e.line[i] = v ? (char)('0'+v) : '.';
+        if(!v) e.open[e.nopen++]=(uint8_t)i;
+    }
+    e.line[N*N]='\n';
+    enum_rec(&e);
+    return e.found;
+}
+
+/* ---------------- Band/stack completion counting ---------------- */
+
+// Exact completion counts for sparse grids, where count_rec would have to
+// walk billions of solutions one at a time. The top band's completions are
+// enumerated and grouped by the digit sets of their nine columns, which is
+// all the two lower bands can see of it; each group's lower completions are
+// then counted once and multiplied by the group size.
+//
+// Lower bands: in every stack each column leaves six digits, split 3/3
+// between the middle and bottom band so that each box gets all nine (56
+// splits per stack). Once the split is fixed a band is filled by giving
+// every digit a row in each of its three boxes; boxes 0 and 1 are walked
+// and box 2 must be the complement, which is a table lookup.
+
+typedef unsigned __int128 u128;
+
+#define PAT_ALL ((1u<<27)-1)   // box row pattern: bit 3*d+r set == digit d in row r
+#define MAX_SPLITS 56
+#define PAT_HASH_BITS 15
+
+typedef struct { uint8_t r, c, d; } Clue;   // band-local row, column, digit 0..8
+
+typedef struct {
+    Clue clue[2][3*N];                      // middle and bottom band givens
+    int nclue[2];
+    int nsplit[3];
+    uint16_t split[3][MAX_SPLITS][3];       // middle-band column sets per stack
+    int nopt[2][3][MAX_SPLITS][3];
+    uint32_t opt[2][3][MAX_SPLITS][3][6];   // row orders of one column's digits
+    uint64_t fill[2][MAX_SPLITS][MAX_SPLITS][MAX_SPLITS];
+    uint32_t hkey[1<<PAT_HASH_BITS];
+    uint64_t hval[1<<PAT_HASH_BITS];        // bit s: key is a box-2 pattern of split s
+    uint16_t hused[MAX_SPLITS*216];         // occupied slots, for cheap clearing
+    int nhused;
+} LowerCounter;
+
+static inline uint32_t pat_slot(uint32_t key){
+    return (key*0x9E3779B1u) >> (32-PAT_HASH_BITS);
+}
+
+static uint64_t* pat_lookup(LowerCounter* lc, uint32_t key, bool insert){
+    for(uint32_t h=pat_slot(key);; h=(h+1)&((1u<<PAT_HASH_BITS)-1)){
+        if(lc->hkey[h]==key) return &lc->hval[h];
+        if(lc->hkey[h]==0){
+            if(!insert) return NULL;
+            lc->hkey[h]=key; lc->hval[h]=0;
+            lc->hused[lc->nhused++]=(uint16_t)h;
+            return &lc->hval[h];
+        }
+    }
+}
+
+// Row orders of each column of band 'b' in stack 'k' for split 's' that
+// agree with the givens. With 'sym' the band has no givens, so its rows are
+// interchangeable: box 0 keeps its first column in ascending order and the
+// caller multiplies by 3!.
+static void lower_options(LowerCounter* lc, const uint16_t colset[N], int b, int k, int s, bool sym){
+    for(int j=0;j<3;j++){
+        int c=3*k+j, dig[3];
+        unsigned m = b==0 ? lc->split[k][s][j] : (ALL & ~colset[c] & ~lc->split[k][s][j]);
+        for(int i=0;i<3;i++){ dig[i]=lsb_index(m); m&=m-1; }
+        int n=0;
+        for(int p=0;p<6;p++){
+            if(sym && c==0 && p) break;
+            uint32_t x=0;
+            for(int i=0;i<3;i++) x |= 1u<<(3*dig[i]+perm3[p][i]);
+            bool ok=true;
+            for(int q=0;q<lc->nclue[b] && ok;q++){
+                const Clue* cl=&lc->clue[b][q];
+                if(cl->c==c && !(x>>(3*cl->d+cl->r) & 1u)) ok=false;
+            }
+            if(ok) lc->opt[b][k][s][j][n++]=x;
+        }
+        lc->nopt[b][k][s][j]=n;
+    }
+}
+
+// Fillings of band 'b' for every combination of per-stack splits. Box 1 is
+// built column by column from row orders that avoid box 0's rows, and box 2
+// must be the complement. With 'other' set, split pairs where that band
+// already has no filling are skipped.
+static void lower_fill(LowerCounter* lc, int b, int other){
+    while(lc->nhused) lc->hkey[lc->hused[--lc->nhused]]=0;
+    for(int s2=0;s2<lc->nsplit[2];s2++){
+        const int* n=lc->nopt[b][2][s2];
+        uint32_t (*o)[6]=lc->opt[b][2][s2];
+        for(int i0=0;i0<n[0];i0++) for(int i1=0;i1<n[1];i1++) for(int i2=0;i2<n[2];i2++)
+            *pat_lookup(lc, o[0][i0]|o[1][i1]|o[2][i2], true) |= 1ull<<s2;
+    }
+
+    for(int s0=0;s0<lc->nsplit[0];s0++)
+    for(int s1=0;s1<lc->nsplit[1];s1++){
+        uint64_t* out=lc->fill[b][s0][s1];
+        memset(out,0,sizeof(uint64_t)*(size_t)lc->nsplit[2]);
+        if(other>=0){
+            uint64_t any=0;
+            for(int s2=0;s2<lc->nsplit[2];s2++) any |= lc->fill[other][s0][s1][s2];
+            if(!any) continue;
+        }
+        const int* na=lc->nopt[b][0][s0];
+        uint32_t (*oa)[6]=lc->opt[b][0][s0];
+        const int* nc=lc->nopt[b][1][s1];
+        uint32_t (*oc)[6]=lc->opt[b][1][s1];
+        for(int i0=0;i0<na[0];i0++) for(int i1=0;i1<na[1];i1++) for(int i2=0;i2<na[2];i2++){
+            uint32_t a=oa[0][i0]|oa[1][i1]|oa[2][i2];
+            uint32_t keep[3][6]; int nk[3];
+            for(int j=0;j<3;j++){
+                nk[j]=0;
+                for(int i=0;i<nc[j];i++) if(!(oc[j][i] & a)) keep[j][nk[j]++]=oc[j][i];
+            }
+            for(int j0=0;j0<nk[0];j0++) for(int j1=0;j1<nk[1];j1++) for(int j2=0;j2<nk[2];j2++){
+                uint32_t rest = PAT_ALL & ~(a|keep[0][j0]|keep[1][j1]|keep[2][j2]);
+                uint64_t* hit=pat_lookup(lc,rest,false);
+                if(!hit) continue;
+                for(uint64_t m=*hit; m; m&=m-1) out[__builtin_ctzll(m)]++;
+            }
+        }
+    }
+}
+
+// Completions of the middle and bottom band below a top band whose columns
+// hold 'colset'.
+static uint64_t lower_count(LowerCounter* lc, const uint16_t colset[N]){
+    for(int k=0;k<3;k++){
+        unsigned comp[3], sub[3][20]; int nsub[3];
+        for(int j=0;j<3;j++){
+            comp[j]=ALL & ~colset[3*k+j];
+            nsub[j]=0;
+            for(unsigned t=comp[j]; t; t=(t-1)&comp[j])
+                if(popcount9(t)==3) sub[j][nsub[j]++]=t;
+        }
+        int n=0;
+        for(int i0=0;i0<nsub[0];i0++)
+        for(int i1=0;i1<nsub[1];i1++){
+            unsigned t0=sub[0][i0], t1=sub[1][i1];
+            if(t0 & t1) continue;
+            unsigned t2=ALL & ~(t0|t1);
+            if(t2 & ~comp[2]) continue;
+            const unsigned t[3]={t0,t1,t2};
+            bool ok=true;
+            for(int b=0;b<2 && ok;b++)
+                for(int q=0;q<lc->nclue[b] && ok;q++){
+                    const Clue* cl=&lc->clue[b][q];
+                    if(cl->c/3!=k) continue;
+                    unsigned have = b==0 ? t[cl->c%3] : comp[cl->c%3] & ~t[cl->c%3];
+                    if(!(have>>cl->d & 1u)) ok=false;
+                }
+            if(!ok) continue;
+            for(int j=0;j<3;j++) lc->split[k][n][j]=(uint16_t)t[j];
+            n++;
+        }
+        lc->nsplit[k]=n;
+        if(!n) return 0;
+    }
+    for(int b=0;b<2;b++)
+        for(int k=0;k<3;k++)
+            for(int s=0;s<lc->nsplit[k];s++) lower_options(lc,colset,b,k,s,lc->nclue[b]==0);
+    int first = lc->nclue[1]>lc->nclue[0];   // the more constrained band prunes the other
+    lower_fill(lc,first,-1);
+    lower_fill(lc,!first,first);
+
+    uint64_t total=0;
+    for(int s0=0;s0<lc->nsplit[0];s0++)
+    for(int s1=0;s1<lc->nsplit[1];s1++)
+    for(int s2=0;s2<lc->nsplit[2];s2++)
+        total += lc->fill[0][s0][s1][s2] * lc->fill[1][s0][s1][s2];
+    for(int b=0;b<2;b++) if(lc->nclue[b]==0) total*=6;
+    return total;
+}
+
+// Open-addressing map from packed top-band column sets to a 64-bit value.
+typedef struct { uint64_t lo, hi, val; } SigEntry;
+typedef struct { SigEntry* e; size_t cap, len; } SigMap;
+
+static inline size_t sig_hash(uint64_t lo, uint64_t hi){
+    uint64_t h=(lo ^ (hi*0xC2B2AE3D27D4EB4Full)) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h>>29));
+}
+
+static bool sigmap_grow(SigMap* m){
+    size_t cap = m->cap ? m->cap*2 : 1024;
+    SigEntry* e=calloc(cap,sizeof *e);
+    if(!e) return false;
+    for(size_t i=0;i<m->cap;i++){
+        if(!m->e[i].lo && !m->e[i].hi) continue;
+        size_t h=sig_hash(m->e[i].lo,m->e[i].hi) & (cap-1);
+        while(e[h].lo || e[h].hi) h=(h+1)&(cap-1);
+        e[h]=m->e[i];
+    }
+    free(m->e); m->e=e; m->cap=cap;
+    return true;
+}
+
+// Entry for a (nonzero) key, created with val 0 if missing; NULL if out of memory.
+static SigEntry* sigmap_get(SigMap* m, uint64_t lo, uint64_t hi){
+    if(2*(m->len+1) > m->cap && !sigmap_grow(m)) return NULL;
+    size_t h=sig_hash(lo,hi) & (m->cap-1);
+    while(m->e[h].lo || m->e[h].hi){
+        if(m->e[h].lo==lo && m->e[h].hi==hi) return &m->e[h];
+        h=(h+1)&(m->cap-1);
+    }
+    m->e[h].lo=lo; m->e[h].hi=hi; m->e[h].val=0;
+    m->len++;
+    return &m->e[h];
+}
+
+static void colset_pack(const uint16_t colset[N], uint64_t* lo, uint64_t* hi){
+    *lo=0;
+    for(int c=0;c<7;c++) *lo |= (uint64_t)colset[c] << (9*c);
+    *hi = (uint64_t)colset[7] | (uint64_t)colset[8]<<9;
+}
+
+static void colset_unpack(uint64_t lo, uint64_t hi, uint16_t colset[N]){
+    for(int c=0;c<7;c++) colset[c]=(uint16_t)(lo>>(9*c) & ALL);
+    colset[7]=(uint16_t)(hi & ALL);
+    colset[8]=(uint16_t)(hi>>9 & ALL);
+}
+
+// Cheap partial normal form: columns sorted within each stack, then stacks
+// sorted. Groups that merge here always share a colset_class.
+static int stack_cmp(const uint16_t* a, const uint16_t* b){
+    for(int j=0;j<3;j++) if(a[j]!=b[j]) return a[j]<b[j] ? -1 : 1;
+    return 0;
+}
+
+static void colset_sort(uint16_t cs[N]){
+    for(int k=0;k<3;k++)
+        for(int i=1;i<3;i++)
+            for(int j=3*k+i; j>3*k && cs[j-1]>cs[j]; j--){ uint16_t x=cs[j]; cs[j]=cs[j-1]; cs[j-1]=x; }
+    for(int i=1;i<3;i++)
+        for(int k=i; k>0 && stack_cmp(&cs[3*k-3],&cs[3*k])>0; k--){
+            uint16_t x[3];
+            memcpy(x,&cs[3*k],sizeof x);
+            memcpy(&cs[3*k],&cs[3*k-3],sizeof x);
+            memcpy(&cs[3*k-3],x,sizeof x);
+        }
+}
+
+// Digits in 'free' appear in no lower given, so their labels do not matter
+// below the top band: relabel them in order of their (column-in-stack)
+// types. Digits sharing a type sit in the same columns, so ties are harmless.
+static void colset_relabel(uint16_t cs[N], unsigned free){
+    int type[N]={0};
+    for(int c=0;c<N;c++)
+        for(unsigned m=cs[c]; m; m&=m-1){
+            int k=c/3, j=c%3;
+            type[lsb_index(m)] += j * (k==0 ? 9 : k==1 ? 3 : 1);
+        }
+    int from[N], n=0;
+    for(unsigned m=free; m; m&=m-1){
+        int d=lsb_index(m), i=n++;
+        for(; i>0 && type[from[i-1]]>type[d]; i--) from[i]=from[i-1];
+        from[i]=d;
+    }
+    int map[N];
+    for(int d=0;d<N;d++) map[d]=d;
+    int i=0;
+    for(unsigned m=free; m; m&=m-1) map[from[i++]]=lsb_index(m);
+    for(int c=0;c<N;c++){
+        unsigned out=0;
+        for(unsigned m=cs[c]; m; m&=m-1) out |= 1u<<map[lsb_index(m)];
+        cs[c]=(uint16_t)out;
+    }
+}
+
+// Class of a top band's column sets under digit relabelling, column swaps
+// within a stack and stack swaps, none of which change an empty lower part:
+// each digit's (column-in-stack) triple is a type 0..26, and the class is
+// the smallest 2-bit-per-type count vector over all 1296 arrangements.
+static uint64_t colset_class(const uint16_t colset[N]){
+    uint8_t t[N][3];
+    for(int k=0;k<3;k++)
+        for(int j=0;j<3;j++)
+            for(unsigned m=colset[3*k+j]; m; m&=m-1) t[lsb_index(m)][k]=(uint8_t)j;
+    uint64_t best=UINT64_MAX;
+    for(int sp=0;sp<6;sp++){
+        const uint8_t* S=perm3[sp];
+        for(int q0=0;q0<6;q0++) for(int q1=0;q1<6;q1++) for(int q2=0;q2<6;q2++){
+            uint64_t key=0;
+            for(int d=0;d<N;d++){
+                int type=9*perm3[q0][t[d][S[0]]] + 3*perm3[q1][t[d][S[1]]] + perm3[q2][t[d][S[2]]];
+                key += 1ull<<(2*type);
+            }
+            if(key<best) best=key;
+        }
+    }
+    return best;
+}
+
+typedef struct {
+    int g[3][N];                 // top band, 0 == empty
+    unsigned row[3], col[N], box[3];
+    unsigned free_digits;        // digits that appear in no given
+    SigMap* groups;              // column sets -> number of top-band completions
+    bool oom;
+} TopBand;
+
+// Box 0 first so the relabelling rule below sees it before anything else.
+static const uint8_t top_order[27] = {
+    0,1,2, 9,10,11, 18,19,20,
+    3,4,5,6,7,8, 12,13,14,15,16,17, 21,22,23,24,25,26 };
+
+// Digits used by no given are interchangeable, so only completions whose
+// box 0 takes them in ascending order are walked (one per relabelling).
+static void top_rec(TopBand* t, int idx){
+    if(t->oom) return;
+    if(idx==27){
+        uint16_t cs[N];
+        for(int c=0;c<N;c++) cs[c]=(uint16_t)t->col[c];
+        uint64_t lo, hi;
+        colset_pack(cs,&lo,&hi);
+        SigEntry* e=sigmap_get(t->groups,lo,hi);
+        if(!e){ t->oom=true; return; }
+        e->val++;
+        return;
+    }
+    int p=top_order[idx], r=p/N, c=p%N, bx=c/3;
+    if(t->g[r][c]){ top_rec(t,idx+1); return; }
+    unsigned cand = ALL & ~(t->row[r] | t->col[c] | t->box[bx]);
+    if(bx==0){
+        unsigned next = t->free_digits & ~t->box[0];
+        cand = (cand & ~t->free_digits) | (cand & next & -next);
+    }
+    while(cand){
+        unsigned bit=cand & -cand; cand ^= bit;
+        t->row[r]|=bit; t->col[c]|=bit; t->box[bx]|=bit;
+        top_rec(t,idx+1);
+        t->row[r]&=~bit; t->col[c]&=~bit; t->box[bx]&=~bit;
+    }
+}
+
+// Exact number of completions of 'b' (0 if it has conflicts or none).
+// Sets *ok to false if memory runs out.
+static u128 count_completions(const Board* b, bool* ok){
+    *ok=true;
+    if(!is_legal(b)) return 0;
+
+    // Put the band or stack with the most givens on top: band swaps and
+    // transposition do not change the count, and a dense top band is cheap.
+    int bestClues=-1, bestBand=0; bool transpose=false;
+    for(int t=0;t<2;t++)
+        for(int band=0;band<3;band++){
+            int n=0;
+            for(int i=band*3;i<band*3+3;i++)
+                for(int j=0;j<N;j++) n += (t ? b->grid[j][i] : b->grid[i][j]) != 0;
+            if(n>bestClues){ bestClues=n; bestBand=band; transpose=t; }
+        }
+    static const int band_order[3][3]={{0,1,2},{1,0,2},{2,0,1}};
+    int o[N][N];
+    for(int i=0;i<N;i++){
+        int src=band_order[bestBand][i/3]*3 + i%3;
+        for(int j=0;j<N;j++) o[i][j] = transpose ? b->grid[j][src] : b->grid[src][j];
+    }
+
+    TopBand* t=calloc(1,sizeof *t);
+    LowerCounter* lc=malloc(sizeof *lc);
+    if(lc){ memset(lc->hkey,0,sizeof lc->hkey); lc->nhused=0; }
+    SigMap groups={0}, merged={0}, classes={0};
+    u128 total=0;
+    if(!t || !lc){ *ok=false; goto out; }
+
+    unsigned used=0;
+    for(int i=0;i<N;i++) for(int j=0;j<N;j++) if(o[i][j]) used |= 1u<<(o[i][j]-1);
+    t->free_digits = ALL & ~used;
+    t->groups=&groups;
+    for(int r=0;r<3;r++) for(int c=0;c<N;c++){
+        int v=o[r][c];
+        t->g[r][c]=v;
+        if(v){ unsigned bit=1u<<(v-1); t->row[r]|=bit; t->col[c]|=bit; t->box[c/3]|=bit; }
+    }
+    lc->nclue[0]=lc->nclue[1]=0;
+    unsigned lower_free=ALL;
+    for(int r=3;r<N;r++) for(int c=0;c<N;c++){
+        if(!o[r][c]) continue;
+        lower_free &= ~(1u<<(o[r][c]-1));
+        int band=r/3-1;
+        lc->clue[band][lc->nclue[band]++] = (Clue){ (uint8_t)(r%3), (uint8_t)c, (uint8_t)(o[r][c]-1) };
+    }
+    bool lower_empty = lc->nclue[0]+lc->nclue[1]==0;
+
+    top_rec(t,0);
+    if(t->oom){ *ok=false; goto out; }
+
+    // Merge groups whose lower count is equal for free: with no lower givens
+    // column and stack order do not matter (and later the whole relabelling
+    // class is shared), otherwise digits given nowhere below can be renamed.
+    for(size_t i=0;i<groups.cap;i++){
+        const SigEntry* g=&groups.e[i];
+        if(!g->lo && !g->hi) continue;
+        uint16_t cs[N]; uint64_t lo, hi;
+        colset_unpack(g->lo,g->hi,cs);
+        if(lower_empty) colset_sort(cs);
+        else colset_relabel(cs,lower_free);
+        colset_pack(cs,&lo,&hi);
+        SigEntry* e=sigmap_get(&merged,lo,hi);
+        if(!e){ *ok=false; goto out; }
+        e->val += g->val;
+    }
+    for(size_t i=0;i<merged.cap;i++){
+        const SigEntry* g=&merged.e[i];
+        if(!g->lo && !g->hi) continue;
+        uint16_t colset[N];
+        colset_unpack(g->lo,g->hi,colset);
+        uint64_t lower;
+        if(lower_empty){
+            SigEntry* cls=sigmap_get(&classes, colset_class(colset), 1);
+            if(!cls){ *ok=false; goto out; }
+            if(!cls->val) cls->val = lower_count(lc,colset) + 1;   // 0 == not counted yet
+            lower = cls->val - 1;
+        } else {
+            lower = lower_count(lc,colset);
+        }
+        total += (u128)g->val * lower;
+    }
+    for(int k=popcount9(t->free_digits); k>1; k--) total *= (unsigned)k;
+
+out:
+    free(groups.e); free(merged.e); free(classes.e);
+    free(t); free(lc);
+    return total;
+}
+
+static void u128_to_str(u128 v, char out[40]){
+    char tmp[40]; int n=0;
+    do { tmp[n++]=(char)('0' + (int)(v%10)); v/=10; } while(v);
+    for(int i=0;i<n;i++) out[i]=tmp[n-1-i];
+    out[n]=0;
+}
+
+/* -------------------- Canonical (minlex) form -------------------- */
+
+// The transforms above (digits, bands, stacks, rows and columns within them,
+// transposition) generate every isomorph of a grid. The canonical form
+// is the lexicographically smallest isomorph reading rows top to bottom,
+// with 0 for empty cells and digits renamed in order of first appearance.
+//
+// It is built one output row at a time. Row 0 is easy: after renaming its
+// givens read 1,2,3,... so only its empty/given pattern matters, and the
+// column orders that push givens right are enumerated directly. Later rows
+// try every input row the band structure allows; only candidates that tie
+// on the smallest prefix survive.
+
+typedef struct {
+    uint8_t t;               // 1: read the transposed grid
+    uint8_t band;            // band of the last row taken
+    uint16_t used;           // input rows taken so far
+    uint8_t row[N];          // output row k shows input row row[k]
+    uint8_t col[N];          // output column j shows input column col[j]
+    uint8_t map[N+1];        // digit renaming, 0 == not yet named
+    uint8_t next;            // next name to hand out
+} CanonCand;
+
+typedef struct { CanonCand* a; size_t len, cap; } CandList;
+
+typedef struct {
+    CandList cur, next;
+} CanonWork;
+
+// How a grid maps onto its canonical form: output cell (k,j) is cell
+// (row[k],col[j]) of the grid (of its transpose when t is set) with digit
+// v renamed map[v]. The renaming is completed to all nine digits.
+typedef struct {
+    uint8_t t;
+    uint8_t row[N], col[N];
+    uint8_t map[N+1];
+} CanonMap;
+
+static void canon_work_free(CanonWork* w){
+    free(w->cur.a); free(w->next.a);
+    memset(w,0,sizeof *w);
+}
+
+static CanonCand* cand_push(CandList* l){
+    if(l->len==l->cap){
+        size_t cap = l->cap ? l->cap*2 : 4096;
+        CanonCand* a=realloc(l->a,cap*sizeof *a);
+        if(!a) return NULL;
+        l->a=a; l->cap=cap;
+    }
+    return &l->a[l->len++];
+}
+
+// Empty/given pattern of row 'r' with its stacks ordered by given count and
+// empty cells first inside each stack, as a 9-bit number (column 0 high).
+static unsigned row_pattern(const uint8_t* row, uint8_t cnt[3]){
+    for(int k=0;k<3;k++) cnt[k]=(uint8_t)((row[3*k]!=0)+(row[3*k+1]!=0)+(row[3*k+2]!=0));
+    uint8_t c[3]={cnt[0],cnt[1],cnt[2]};
+    for(int i=1;i<3;i++) for(int j=i;j>0 && c[j-1]>c[j];j--){ uint8_t x=c[j]; c[j]=c[j-1]; c[j-1]=x; }
+    unsigned pat=0;
+    for(int k=0;k<3;k++) pat = (pat<<3) | ((1u<<c[k])-1);
+    return pat;
+}
+
+// Compare the image of 'row' under column order 'col' and renaming 'map'
+// with 'best', naming new digits as they appear. Stops at the first larger
+// cell (map is then partial); on a smaller image 'best' is overwritten.
+static inline int image_cmp(const uint8_t* row, const uint8_t* col, uint8_t* map, uint8_t* next, uint8_t* best){
+    int j=0;
+    for(; j<N; j++){
+        int v=row[col[j]];
+        if(v && !map[v]) map[v]=(*next)++;
+        if(map[v]!=best[j]) break;
+    }
+    if(j==N) return 0;
+    if(map[row[col[j]]]>best[j]) return 1;
+    for(; j<N; j++){
+        int v=row[col[j]];
+        if(v && !map[v]) map[v]=(*next)++;
+        best[j]=map[v];
+    }
+    return -1;
+}
+
+// Canonical form of 'in' into 'out', and into 'how' (if not NULL) one
+// transform that produces it. Returns false if memory runs out.
+static bool canon_form(const Board* in, Board* out, CanonWork* w, CanonMap* how){
+    uint8_t g[2][N][N];
+    for(int r=0;r<N;r++) for(int c=0;c<N;c++){
+        g[0][r][c]=(uint8_t)in->grid[r][c];
+        g[1][c][r]=(uint8_t)in->grid[r][c];
+    }
+
+    // Row 0: best pattern over both orientations and all nine rows.
+    unsigned best=UINT_MAX;
+    uint8_t cnt[2][N][3];
+    unsigned pat[2][N];
+    for(int t=0;t<2;t++)
+        for(int r=0;r<N;r++){
+            pat[t][r]=row_pattern(g[t][r],cnt[t][r]);
+            if(pat[t][r]<best) best=pat[t][r];
+        }
+    uint8_t bestRow1[N];
+    memset(bestRow1,0xFF,sizeof bestRow1);
+    w->cur.len=0;
+    for(int t=0;t<2;t++)
+    for(int r=0;r<N;r++){
+        if(pat[t][r]!=best) continue;
+        const uint8_t* row=g[t][r];
+        // Orders of each stack's columns that put its empty cells first.
+        uint8_t qs[3][6]; int nq[3];
+        for(int k=0;k<3;k++){
+            nq[k]=0;
+            for(int q=0;q<6;q++){
+                const uint8_t* P=perm3[q];
+                if((row[3*k+P[0]] && !row[3*k+P[1]]) || (row[3*k+P[1]] && !row[3*k+P[2]])) continue;
+                qs[k][nq[k]++]=(uint8_t)q;
+            }
+        }
+        for(int sp=0;sp<6;sp++){
+            const uint8_t* S=perm3[sp];
+            if(cnt[t][r][S[0]]>cnt[t][r][S[1]] || cnt[t][r][S[1]]>cnt[t][r][S[2]]) continue;
+            for(int i0=0;i0<nq[S[0]];i0++) for(int i1=0;i1<nq[S[1]];i1++) for(int i2=0;i2<nq[S[2]];i2++){
+                const int q[3]={qs[S[0]][i0],qs[S[1]][i1],qs[S[2]][i2]};
+                uint8_t col[N];
+                for(int k=0;k<3;k++)
+                    for(int i=0;i<3;i++) col[3*k+i]=(uint8_t)(3*S[k]+perm3[q[k]][i]);
+                // Name row 0's givens, then score both rows that may follow
+                // in the band; only ties on rows 0-1 become candidates.
+                uint8_t map0[N+1]={0}, next0=1;
+                for(int j=0;j<N;j++){
+                    int v=row[col[j]];
+                    if(v) map0[v]=next0++;
+                }
+                for(int r1=3*(r/3); r1<3*(r/3)+3; r1++){
+                    if(r1==r) continue;
+                    uint8_t map[N+1], next=next0;
+                    memcpy(map,map0,sizeof map);
+                    int cmp=image_cmp(g[t][r1],col,map,&next,bestRow1);
+                    if(cmp>0) continue;
+                    if(cmp<0) w->cur.len=0;
+                    CanonCand* cd=cand_push(&w->cur);
+                    if(!cd) return false;
+                    cd->t=(uint8_t)t; cd->band=(uint8_t)(r/3);
+                    cd->used=(uint16_t)(1u<<r | 1u<<r1);
+                    cd->row[0]=(uint8_t)r; cd->row[1]=(uint8_t)r1;
+                    memcpy(cd->col,col,N);
+                    memcpy(cd->map,map,sizeof map);
+                    cd->next=next;
+                }
+            }
+        }
+    }
+    {
+        int name=1;
+        for(int j=0;j<N;j++){
+            out->grid[0][j] = (best>>(N-1-j) & 1u) ? name++ : 0;
+            out->grid[1][j] = bestRow1[j];
+        }
+    }
+
+    // Rows 2..8.
+    for(int k=2;k<N;k++){
+        uint8_t bestRow[N];
+        memset(bestRow,0xFF,sizeof bestRow);
+        w->next.len=0;
+        for(size_t i=0;i<w->cur.len;i++){
+            const CanonCand* cd=&w->cur.a[i];
+            unsigned rows;
+            if(k%3) rows = (0x7u<<(3*cd->band)) & ~cd->used;
+            else {
+                rows=0;
+                for(int b=0;b<3;b++) if(!(cd->used>>(3*b) & 7u)) rows |= 0x7u<<(3*b);
+            }
+            for(; rows; rows&=rows-1){
+                int r=lsb_index(rows);
+                uint8_t map[N+1], next=cd->next;
+                memcpy(map,cd->map,sizeof map);
+                int cmp=image_cmp(g[cd->t][r],cd->col,map,&next,bestRow);
+                if(cmp>0) continue;
+                if(cmp<0) w->next.len=0;
+                CanonCand* nd=cand_push(&w->next);
+                if(!nd) return false;
+                *nd=*cd;
+                nd->band=(uint8_t)(r/3); nd->used |= (uint16_t)(1u<<r);
+                nd->row[k]=(uint8_t)r;
+                memcpy(nd->map,map,sizeof map); nd->next=next;
+            }
+        }
+        for(int j=0;j<N;j++) out->grid[k][j]=bestRow[j];
+        CandList tmp=w->cur; w->cur=w->next; w->next=tmp;
+    }
+    if(how){
+        const CanonCand* cd=&w->cur.a[0];
+        how->t=cd->t;
+        memcpy(how->row,cd->row,N);
+        memcpy(how->col,cd->col,N);
+        memcpy(how->map,cd->map,sizeof how->map);
+        uint8_t next=cd->next;
+        for(int v=1;v<=N;v++) if(!how->map[v]) how->map[v]=next++;
+    }
+    return true;
+}
+
+// 81 cells packed four bits each; equal grids pack equal.
+typedef struct { uint64_t w[6]; } PackedGrid;
+
+static PackedGrid pack_grid(const Board* b){
+    PackedGrid p={{0}};
+    for(int i=0;i<N*N;i++) p.w[i/16] |= (uint64_t)b->grid[i/N][i%N] << (4*(i%16));
+    return p;
+}
+
+typedef struct {
+    PackedGrid* e;           // all-zero words == free slot (the empty grid is kept aside)
+    size_t cap, len;
+    bool has_empty;
+} GridSet;
+
+static size_t packed_hash(const PackedGrid* p){
+    uint64_t h=0;
+    for(int i=0;i<6;i++) h = mix64(h ^ p->w[i]);
+    return (size_t)h;
+}
+
+static bool packed_is_zero(const PackedGrid* p){
+    return !(p->w[0]|p->w[1]|p->w[2]|p->w[3]|p->w[4]|p->w[5]);
+}
+
+// Adds 'p'; returns 1 if new, 0 if already present, -1 if out of memory.
+static int gridset_add(GridSet* s, const PackedGrid* p){
+    if(packed_is_zero(p)){
+        if(s->has_empty) return 0;
+        s->has_empty=true;
+        return 1;
+    }
+    if(2*(s->len+1) > s->cap){
+        size_t cap = s->cap ? s->cap*2 : 1<<16;
+        PackedGrid* e=calloc(cap,sizeof *e);
+        if(!e) return -1;
+        for(size_t i=0;i<s->cap;i++){
+            if(packed_is_zero(&s->e[i])) continue;
+            size_t h=packed_hash(&s->e[i]) & (cap-1);
+            while(!packed_is_zero(&e[h])) h=(h+1)&(cap-1);
+            e[h]=s->e[i];
+        }
+        free(s->e); s->e=e; s->cap=cap;
+    }
+    size_t h=packed_hash(p) & (s->cap-1);
+    while(!packed_is_zero(&s->e[h])){
+        if(memcmp(&s->e[h],p,sizeof *p)==0) return 0;
+        h=(h+1)&(s->cap-1);
+    }
+    s->e[h]=*p;
+    s->len++;
+    return 1;
+}
+
+/* ------------------------- Portfolio solver ------------------------- */
+
+// A hard puzzle can trap one search order in a huge subtree that another
+// order walks past. portfolio_solve first gives the plain solver
+// PORT_HEDGE nodes, which almost every puzzle needs fewer of. Past that it
+// races the strategies below on separate threads: the first to finish
+// answers, and sets a flag the others poll to give up.
+#define PORT_HEDGE 2048
+#define PORT_STRATEGIES 4
+
+static const char* const port_name[PORT_STRATEGIES] = { "mrv", "mrv-desc", "singles", "transposed" };
+
+typedef struct {
+    int racers;                      // threads per race, 1..PORT_STRATEGIES
+    atomic_ullong calls, raced;
+    atomic_ullong wins[PORT_STRATEGIES];
+} Portfolio;
+
+typedef struct {
+    Board in, out;
+    Bounds bound;                    // the caller's, for every racer
+    atomic_int done;
+    atomic_int winner;               // -1 until a strategy answers
+    bool solved;
+} Race;
+
+typedef struct { Race* race; int strategy; } Racer;
+
+static void portfolio_init(Portfolio* pf, int threads){
+    pf->racers = threads<1 ? 1 : threads>PORT_STRATEGIES ? PORT_STRATEGIES : threads;
+    atomic_init(&pf->calls,0);
+    atomic_init(&pf->raced,0);
+    for(int i=0;i<PORT_STRATEGIES;i++) atomic_init(&pf->wins[i],0);
+}
+
+// The transposed grid with digits reversed: its own inverse.
+static void port_mirror(const Board* in, Board* out){
+    for(int r=0;r<N;r++) for(int c=0;c<N;c++)
+        out->grid[c][r] = in->grid[r][c] ? N+1-in->grid[r][c] : 0;
+}
+
+static void* port_racer(void* arg){
+    Race* race=((Racer*)arg)->race;
+    int k=((Racer*)arg)->strategy;
+    TRACE_SCOPE(port_name[k]);
+    Search s={ .order = k==1 ? ORDER_DESCENDING : ORDER_ASCENDING, .singles = k==2, .bound=race->bound };
+    s.bound.stop=&race->done;
+    Board b;
+    if(k==3) port_mirror(&race->in,&b);
+    else b=race->in;
+    bool ok=search_solve(&b,&s);
+    int none=-1;
+    if(!s.bound.gave_up && atomic_compare_exchange_strong(&race->winner,&none,k)){
+        race->solved=ok;
+        if(ok && k==3) port_mirror(&b,&race->out);
+        else if(ok) race->out=b;
+        atomic_store_explicit(&race->done,1,memory_order_relaxed);
+    }
+    return NULL;
+}
+
+// Solves the legal board 'b' in place within 'bound' (optional; a node
+// limit applies to each strategy): 1 if solved, 0 (and 'b' untouched) if
+// it has no solution, SUDOKU_GAVE_UP if out of bounds.
+static int portfolio_solve(Portfolio* pf, Board* b, const Bounds* bound){
+    atomic_fetch_add_explicit(&pf->calls,1,memory_order_relaxed);
+    Bounds bd = bound ? *bound : (Bounds){0};
+    Search s={ .bound=bd };
+    if(!bd.limit || bd.limit>PORT_HEDGE) s.bound.limit=PORT_HEDGE;
+    Board t=*b;
+    if(search_solve(&t,&s)){ *b=t; return 1; }
+    if(!s.bound.gave_up) return 0;
+    if(s.nodes<=PORT_HEDGE || (bd.limit && bd.limit<=PORT_HEDGE)) return SUDOKU_GAVE_UP;   // the caller's bound
+
+    TRACE_SCOPE("race");
+    atomic_fetch_add_explicit(&pf->raced,1,memory_order_relaxed);
+    Race race={ .in=*b, .bound=bd };
+    atomic_init(&race.done,0);
+    atomic_init(&race.winner,-1);
+    Racer racer[PORT_STRATEGIES];
+    pthread_t tid[PORT_STRATEGIES];
+    int started=0;
+    for(int k=0;k<PORT_STRATEGIES;k++) racer[k]=(Racer){ &race, k };
+    for(int k=1;k<pf->racers;k++)
+        if(pthread_create(&tid[started],NULL,port_racer,&racer[k])==0) started++;
+    port_racer(&racer[0]);
+    for(int i=0;i<started;i++) pthread_join(tid[i],NULL);
+    int w=atomic_load(&race.winner);
+    if(w<0) return SUDOKU_GAVE_UP;
+    atomic_fetch_add_explicit(&pf->wins[w],1,memory_order_relaxed);
+    if(race.solved) *b=race.out;
+    return race.solved;
+}
+
+// "CALLS RACED mrv W mrv-desc W ...": how many solves needed a race and
+// which strategy won each.
+static size_t portfolio_format(const Portfolio* pf, char* out, size_t cap){
+    int n=snprintf(out,cap,"%llu %llu", (unsigned long long)atomic_load(&pf->calls),
+                   (unsigned long long)atomic_load(&pf->raced));
+    for(int i=0;i<PORT_STRATEGIES && n>0 && (size_t)n<cap;i++)
+        n+=snprintf(out+n,cap-(size_t)n," %s %llu", port_name[i], (unsigned long long)atomic_load(&pf->wins[i]));
+    return n>0 && (size_t)n<cap ? (size_t)n : 0;
+}
+
+/* ------------------------- Game UI ------------------------- */
+
+static void print_help(void){
+    puts("Commands:");
+    puts("  set r c v     - place value v (1..9) at row r, col c (1..9)");
+    puts("  clear r c     - clear cell at (r,c)");
+    puts("  hint r c      - fill the correct value for (r,c)");
+    puts("  check         - verify no rule is violated");
+    puts("  solve         - fill the whole solution");
+    puts("  restart       - revert to the original puzzle");
+    puts("  print         - show the current board");
+    puts("  help          - show this help");
+    puts("  quit          - exit");
+}
+
+static bool read_line_from(FILE* f, char* buf, size_t cap){
+    if(!fgets(buf,(int)cap,f)) return false;
+    size_t n=strlen(buf);
+    if(n && buf[n-1]=='\n') buf[--n]=0;
+    if(n && buf[n-1]=='\r') buf[n-1]=0;
+    return true;
+}
+
+static bool read_line(char* buf, size_t cap){
+    return read_line_from(stdin,buf,cap);
+}
+
+static bool parse_ints(const char* s, int* a, int need){
+    int count=0;
+    while(*s && count<need){
+        while(*s && isspace((unsigned char)*s)) s++;
+        if(!*s) break;
+        char* end=NULL;
+        long v=strtol(s,&end,10);
+        if(s==end) return false;
+        a[count++]=(int)v;
+        s=end;
+    }
+    return count==need;
+}
+
+static bool can_place(const Board* current, const Board* fixed, int r, int c, int v){
+    if(fixed->grid[r][c]) return false;
+    for(int i=0;i<N;i++){
+        if(current->grid[r][i]==v) return false;
+        if(current->grid[i][c]==v) return false;
+    }
+    int br=(r/3)*3, bc=(c/3)*3;
+    for(int dr=0;dr<3;dr++) for(int dc=0;dc<3;dc++)
+        if(current->grid[br+dr][bc+dc]==v) return false;
+    return true;
+}
+
+static sudoku_check check_board(const Board* b){
+    uint8_t cell[N*N];
+    board_to_cells(b,cell);
+    return sudoku_validate(cell,NULL);
+}
+
+static bool is_complete_and_correct(const Board* current){
+    return check_board(current)==SUDOKU_SOLVED;
+}
+
+// Solves 'b' in place, racing strategies on hard boards; false (and 'b'
+// untouched) if it cannot.
+static bool solve_with(Portfolio* pf, Board* b){
+    return is_legal(b) && portfolio_solve(pf,b,NULL)==1;
+}
+
+static Difficulty parse_difficulty(const char* s){
+    if(!s) return DIFF_MEDIUM;
+    if(strncmp(s,"easy",4)==0) return DIFF_EASY;
+    if(strncmp(s,"hard",4)==0) return DIFF_HARD;
+    return DIFF_MEDIUM;
+}
+
+static void prompt_difficulty(Difficulty* d){
+    char buf[64];
+    puts("Choose difficulty: easy / medium / hard [default: medium]");
+    printf("> "); fflush(stdout);
+    if(!read_line(buf,sizeof(buf))) { *d=DIFF_MEDIUM; return; }
+    for(char* p=buf; *p; ++p) *p=(char)tolower((unsigned char)*p);
+    if(buf[0]==0) { *d=DIFF_MEDIUM; return; }
+    *d = parse_difficulty(buf);
+}
+
+/* ------------------------- Batch modes ------------------------- */
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+// Latency summaries of LatHist (libsudoku.c): calls, then p50, p90, p99,
+// p99.9, p99.99 and the maximum, in microseconds.
+static const double lat_points[] = { 0.5, 0.9, 0.99, 0.999, 0.9999, 1 };
+static const char* const op_name[SUDOKU_OPS] = { "solve", "count", "complete", "puzzle" };
+
+// Adds 'src' into 'dst'; 'dst' must be private to the caller.
+static void lat_merge(LatHist* dst, const LatHist* src){
+    for(int i=0;i<LAT_BUCKETS;i++)
+        lat_bump(&dst->count[i],atomic_load_explicit(&src->count[i],memory_order_relaxed));
+    lat_bump(&dst->calls,atomic_load_explicit(&src->calls,memory_order_relaxed));
+    uint64_t m=atomic_load_explicit(&src->max,memory_order_relaxed);
+    if(m>atomic_load_explicit(&dst->max,memory_order_relaxed)) atomic_store_explicit(&dst->max,m,memory_order_relaxed);
+}
+
+static size_t lat_format(const LatHist* h, char* out, size_t cap){
+    size_t k=(size_t)snprintf(out,cap,"%llu",(unsigned long long)atomic_load_explicit(&h->calls,memory_order_relaxed));
+    for(size_t i=0;i<sizeof lat_points/sizeof lat_points[0] && k<cap;i++)
+        k+=(size_t)snprintf(out+k,cap-k," %.1f",(double)lat_quantile(h,lat_points[i])/1e3);
+    return k<cap ? k : cap-1;
+}
+
+// One row of a latency table on stderr; nothing if 'h' is empty. A NULL
+// 'h' prints the column heads.
+static void lat_print(const char* name, const LatHist* h){
+    if(!h){
+        fprintf(stderr,"%-9s %10s %9s %9s %9s %9s %9s %9s\n", "us", "calls", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+        return;
+    }
+    unsigned long long calls=atomic_load_explicit(&h->calls,memory_order_relaxed);
+    if(!calls) return;
+    fprintf(stderr,"%-9s %10llu", name, calls);
+    for(size_t i=0;i<sizeof lat_points/sizeof lat_points[0];i++)
+        fprintf(stderr," %9.1f",(double)lat_quantile(h,lat_points[i])/1e3);
+    fputc('\n',stderr);
+}
+
+// Grid lines are 81 characters, '1'..'9' for givens and '0' or '.' for
+// empty cells. Conversion to and from byte cells (0 == empty) runs 16
+// characters per SSE2 compare/select; the last cell is done on its own.
+static bool line_to_cells(const char* s, uint8_t cell[N*N]){
+    int i=0;
+#ifdef __SSE2__
+    const __m128i ch0=_mm_set1_epi8('0'), dot=_mm_set1_epi8('.'), nine=_mm_set1_epi8(9);
+    __m128i ok=_mm_set1_epi8(-1);
+    for(;i+16<=N*N;i+=16){
+        __m128i c=_mm_loadu_si128((const __m128i*)(s+i));
+        __m128i d=_mm_sub_epi8(c,ch0);
+        __m128i dig=_mm_cmpeq_epi8(_mm_min_epu8(d,nine),d);     // '0'..'9'
+        ok=_mm_and_si128(ok,_mm_or_si128(dig,_mm_cmpeq_epi8(c,dot)));
+        _mm_storeu_si128((__m128i*)(cell+i),_mm_and_si128(d,dig));
+    }
+    if(_mm_movemask_epi8(ok)!=0xFFFF) return false;
+#endif
+    for(;i<N*N;i++){
+        char ch=s[i];
+        if(ch>='0' && ch<='9') cell[i]=(uint8_t)(ch-'0');
+        else if(ch=='.') cell[i]=0;
+        else return false;
+    }
+    return true;
+}
+
+static void cells_to_line(const uint8_t cell[N*N], char* s){
+    int i=0;
+#ifdef __SSE2__
+    const __m128i zero=_mm_setzero_si128(), ch0=_mm_set1_epi8('0'), dot=_mm_set1_epi8('.');
+    for(;i+16<=N*N;i+=16){
+        __m128i v=_mm_loadu_si128((const __m128i*)(cell+i));
+        __m128i empty=_mm_cmpeq_epi8(v,zero);
+        __m128i c=_mm_or_si128(_mm_and_si128(empty,dot),_mm_andnot_si128(empty,_mm_add_epi8(v,ch0)));
+        _mm_storeu_si128((__m128i*)(s+i),c);
+    }
+#endif
+    for(;i<N*N;i++) s[i] = cell[i] ? (char)('0'+cell[i]) : '.';
+}
+
+static void board_to_line(const Board* b, char* s){
+    uint8_t cell[N*N];
+    const int* g=&b->grid[0][0];
+    for(int i=0;i<N*N;i++) cell[i]=(uint8_t)g[i];
+    cells_to_line(cell,s);
+}
+
+static FILE* open_input(const char* path){
+    if(!path || strcmp(path,"-")==0) return stdin;
+    FILE* f=fopen(path,"r");
+    if(!f) perror(path);
+    return f;
+}
+
+static int default_threads(void){
+    long n=sysconf(_SC_NPROCESSORS_ONLN);
+    return n>0 ? (int)n : 1;
+}
+
+// Puzzle bank: a 64-byte header, then fixed-size records, so record i starts
+// at byte 64 + i*size and is reached without scanning. Cells are packed two
+// to a byte, low nibble first (0 == empty); fields are little-endian.
+//
+//   header  "SDKBANK1", u32 version, u32 flags, u32 record size,
+//           u32 reserved, u64 record count (0: records run to end of file)
+//   record  u8 clues, u8 difficulty (0 unknown, 1 easy, 2 medium, 3 hard),
+//           u16 rating (search nodes to prove uniqueness, saturating),
+//           41 bytes of puzzle, then 41 of solution with BANK_SOLUTIONS
+#define BANK_MAGIC "SDKBANK1"
+#define BANK_VERSION 1
+#define BANK_HEADER 64
+#define BANK_META 4
+#define BANK_CELLS ((N*N+1)/2)
+#define BANK_SOLUTIONS 1u
+
+typedef struct {
+    uint32_t flags;
+    uint32_t size;           // bytes per record
+    uint64_t count;
+} BankHeader;
+
+static uint32_t bank_record_size(uint32_t flags){
+    return BANK_META + BANK_CELLS*((flags&BANK_SOLUTIONS) ? 2 : 1);
+}
+
+static void put_le(uint8_t* p, uint64_t v, int bytes){
+    for(int i=0;i<bytes;i++) p[i]=(uint8_t)(v>>(8*i));
+}
+
+static uint64_t get_le(const uint8_t* p, int bytes){
+    uint64_t v=0;
+    for(int i=0;i<bytes;i++) v|=(uint64_t)p[i]<<(8*i);
+    return v;
+}
+
+static void bank_header_put(uint8_t out[BANK_HEADER], const BankHeader* h){
+    memset(out,0,BANK_HEADER);
+    memcpy(out,BANK_MAGIC,8);
+    put_le(out+8,BANK_VERSION,4);
+    put_le(out+12,h->flags,4);
+    put_le(out+16,h->size,4);
+    put_le(out+24,h->count,8);
+}
+
+// False unless 'in' is a header this build can read.
+static bool bank_header_get(const uint8_t in[BANK_HEADER], BankHeader* h){
+    if(memcmp(in,BANK_MAGIC,8)!=0 || get_le(in+8,4)!=BANK_VERSION) return false;
+    h->flags=(uint32_t)get_le(in+12,4);
+    h->size=(uint32_t)get_le(in+16,4);
+    h->count=get_le(in+24,8);
+    return h->flags<=BANK_SOLUTIONS && h->size==bank_record_size(h->flags);
+}
+
+static void pack_cells(const uint8_t cell[N*N], uint8_t out[BANK_CELLS]){
+    for(int i=0;i<N*N/2;i++) out[i]=(uint8_t)(cell[2*i] | cell[2*i+1]<<4);
+    out[N*N/2]=cell[N*N-1];
+}
+
+// False if a nibble is not a digit. The first 64 cells come out of two
+// 16-byte loads, split into low and high nibbles and interleaved.
+static bool unpack_cells(const uint8_t in[BANK_CELLS], uint8_t cell[N*N]){
+    int i=0;
+    uint8_t over=0;
+#ifdef __SSE2__
+    const __m128i low=_mm_set1_epi8(0x0F), nine=_mm_set1_epi8(9);
+    __m128i bad=_mm_setzero_si128();
+    for(;i<32;i+=16){
+        __m128i v=_mm_loadu_si128((const __m128i*)(in+i));
+        __m128i lo=_mm_and_si128(v,low), hi=_mm_and_si128(_mm_srli_epi16(v,4),low);
+        _mm_storeu_si128((__m128i*)(cell+2*i),_mm_unpacklo_epi8(lo,hi));
+        _mm_storeu_si128((__m128i*)(cell+2*i+16),_mm_unpackhi_epi8(lo,hi));
+        bad=_mm_or_si128(bad,_mm_subs_epu8(_mm_max_epu8(lo,hi),nine));
+    }
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(bad,_mm_setzero_si128()))!=0xFFFF) return false;
+#endif
+    for(;i<N*N/2;i++){
+        cell[2*i]=in[i]&15; cell[2*i+1]=in[i]>>4;
+        over|=cell[2*i]>9 || cell[2*i+1]>9;
+    }
+    cell[N*N-1]=in[N*N/2]&15;
+    return !over && cell[N*N-1]<=9;
+}
+
+// Solution cache: a file-backed open-addressing table from puzzle to
+// solution that any number of processes map at once. A solved puzzle gets
+// two slots, one for the grid as given and one for its canonical form, so
+// a verbatim repeat costs one probe and an isomorph one canon_form. Slots
+// are filled once and never changed: the single writer (under flock, and a
+// mutex between threads) fills a slot's body and publishes its key last,
+// so readers take no lock. Inserts stop at 3/4 load. The file is in native
+// byte order; it is a cache, not an interchange format.
+#define CACHE_MAGIC "SDKCACHE"
+#define CACHE_VERSION 1
+#define CACHE_SLOTS (1u<<20)
+
+enum { CACHE_GIVEN=1, CACHE_CANON=2 };
+
+typedef struct {
+    char magic[8];
+    uint32_t version, slot_size;
+    uint64_t slots;                   // a power of two
+    _Atomic uint64_t used;
+    uint8_t pad[32];
+} CacheHeader;
+
+typedef struct {
+    _Atomic uint64_t key;             // 0 == free
+    uint8_t puzzle[BANK_CELLS];       // packed like bank records
+    uint8_t solution[BANK_CELLS];     // all empty: the puzzle has none
+    uint8_t kind;
+    uint8_t pad;
+    uint32_t micros;                  // what solving it cost
+} CacheSlot;
+
+_Static_assert(sizeof(CacheHeader)==64 && sizeof(CacheSlot)==96, "cache file layout");
+
+typedef struct {
+    int fd;
+    CacheHeader* head;
+    CacheSlot* slot;
+    size_t cap, map_len;
+    pthread_mutex_t lock;
+    atomic_ullong hits, misses, stores;
+    atomic_ullong saved_us;           // solve time the hits stood in for
+} SolutionCache;
+
+// A puzzle's lookup state, kept so a miss can be stored without redoing
+// the canonical form.
+typedef struct {
+    uint8_t given[BANK_CELLS], canon[BANK_CELLS];
+    uint64_t key_given, key_canon;    // key_canon 0: no canonical form
+    CanonMap how;
+} CacheKey;
+
+static bool cache_open(SolutionCache* c, const char* path, size_t slots){
+    memset(c,0,sizeof *c);
+    c->fd=open(path,O_RDWR|O_CREAT,0644);
+    if(c->fd<0){ perror(path); return false; }
+    flock(c->fd,LOCK_EX);
+    struct stat sb;
+    CacheHeader h;
+    bool ok = fstat(c->fd,&sb)==0;
+    if(ok && sb.st_size==0){
+        size_t cap=1024;
+        while(cap<slots) cap<<=1;
+        h=(CacheHeader){ .version=CACHE_VERSION, .slot_size=sizeof(CacheSlot), .slots=cap };
+        memcpy(h.magic,CACHE_MAGIC,8);
+        sb.st_size=(off_t)(sizeof h+cap*sizeof(CacheSlot));
+        ok = ftruncate(c->fd,sb.st_size)==0 && pwrite(c->fd,&h,sizeof h,0)==(ssize_t)sizeof h;
+    } else {
+        ok = ok && pread(c->fd,&h,sizeof h,0)==(ssize_t)sizeof h && memcmp(h.magic,CACHE_MAGIC,8)==0
+             && h.version==CACHE_VERSION && h.slot_size==sizeof(CacheSlot)
+             && h.slots && !(h.slots&(h.slots-1))
+             && (uint64_t)sb.st_size>=sizeof h+h.slots*sizeof(CacheSlot);
+    }
+    if(ok){
+        c->cap=(size_t)h.slots;
+        c->map_len=sizeof h+c->cap*sizeof(CacheSlot);
+        void* m=mmap(NULL,c->map_len,PROT_READ|PROT_WRITE,MAP_SHARED,c->fd,0);
+        ok = m!=MAP_FAILED;
+        if(ok){ c->head=m; c->slot=(CacheSlot*)(c->head+1); }
+    }
+    flock(c->fd,LOCK_UN);
+    if(!ok){
+        fprintf(stderr,"%s: not a usable solution cache\n", path);
+        close(c->fd);
+        return false;
+    }
+    pthread_mutex_init(&c->lock,NULL);
+    return true;
+}
+
+static void cache_close(SolutionCache* c){
+    munmap(c->head,c->map_len);
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+}
+
+static uint64_t cache_hash(const uint8_t p[BANK_CELLS], int kind){
+    uint64_t h=(uint64_t)kind, w;
+    for(int i=0;i+8<=BANK_CELLS;i+=8){ memcpy(&w,p+i,8); h=mix64(h^w); }
+    h=mix64(h^p[BANK_CELLS-1]);
+    return h ? h : 1;
+}
+
+static CacheSlot* cache_find(SolutionCache* c, uint64_t key, int kind, const uint8_t p[BANK_CELLS]){
+    for(size_t i=key&(c->cap-1);;i=(i+1)&(c->cap-1)){
+        CacheSlot* s=&c->slot[i];
+        uint64_t k=atomic_load_explicit(&s->key,memory_order_acquire);
+        if(!k) return NULL;
+        if(k==key && s->kind==kind && memcmp(s->puzzle,p,BANK_CELLS)==0) return s;
+    }
+}
+
+static void cache_fill(SolutionCache* c, uint64_t key, int kind, const uint8_t p[BANK_CELLS],
+                       const uint8_t sol[N*N], uint32_t micros){
+    pthread_mutex_lock(&c->lock);
+    flock(c->fd,LOCK_EX);
+    uint64_t used=atomic_load_explicit(&c->head->used,memory_order_relaxed);
+    if(4*(used+1)<=3*(uint64_t)c->cap && !cache_find(c,key,kind,p)){
+        size_t i=key&(c->cap-1);
+        while(atomic_load_explicit(&c->slot[i].key,memory_order_relaxed)) i=(i+1)&(c->cap-1);
+        CacheSlot* s=&c->slot[i];
+        memcpy(s->puzzle,p,BANK_CELLS);
+        pack_cells(sol,s->solution);
+        s->kind=(uint8_t)kind;
+        s->micros=micros;
+        atomic_store_explicit(&s->key,key,memory_order_release);
+        atomic_store_explicit(&c->head->used,used+1,memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->stores,1,memory_order_relaxed);
+    }
+    flock(c->fd,LOCK_UN);
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Cell of the grid (or its transpose) that canonical cell i comes from.
+static inline int canon_source(const CanonMap* how, int i){
+    int r=how->row[i/N], c=how->col[i%N];
+    return how->t ? c*N+r : r*N+c;
+}
+
+// Looks 'cell' up, first as given, then by canonical form. On a hit 'sol'
+// gets the solution (all empty when there is none) and true comes back;
+// on a miss 'k' is left ready for cache_store.
+static bool cache_lookup(SolutionCache* c, const uint8_t cell[N*N], uint8_t sol[N*N],
+                         CacheKey* k, CanonWork* w){
+    pack_cells(cell,k->given);
+    k->key_given=cache_hash(k->given,CACHE_GIVEN);
+    k->key_canon=0;
+    const CacheSlot* s=cache_find(c,k->key_given,CACHE_GIVEN,k->given);
+    if(!s){
+        Board b, cb;
+        int* g=&b.grid[0][0];
+        for(int i=0;i<N*N;i++) g[i]=cell[i];
+        if(!canon_form(&b,&cb,w,&k->how)){
+            atomic_fetch_add_explicit(&c->misses,1,memory_order_relaxed);
+            return false;
+        }
+        uint8_t cc[N*N];
+        const int* cg=&cb.grid[0][0];
+        for(int i=0;i<N*N;i++) cc[i]=(uint8_t)cg[i];
+        pack_cells(cc,k->canon);
+        k->key_canon=cache_hash(k->canon,CACHE_CANON);
+        s=cache_find(c,k->key_canon,CACHE_CANON,k->canon);
+        if(!s){
+            atomic_fetch_add_explicit(&c->misses,1,memory_order_relaxed);
+            return false;
+        }
+        uint8_t cs[N*N], inv[N+1]={0};
+        unpack_cells(s->solution,cs);
+        for(int v=1;v<=N;v++) inv[k->how.map[v]]=(uint8_t)v;
+        for(int i=0;i<N*N;i++) sol[canon_source(&k->how,i)]=inv[cs[i]];
+        cache_fill(c,k->key_given,CACHE_GIVEN,k->given,sol,s->micros);    // next time, one probe
+    } else unpack_cells(s->solution,sol);
+    atomic_fetch_add_explicit(&c->hits,1,memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->saved_us,s->micros,memory_order_relaxed);
+    return true;
+}
+
+// Stores the solution of a missed puzzle ('sol' NULL: it has none).
+static void cache_store(SolutionCache* c, const CacheKey* k, const uint8_t* sol, uint32_t micros){
+    uint8_t none[N*N]={0}, cs[N*N];
+    if(!sol) sol=none;
+    cache_fill(c,k->key_given,CACHE_GIVEN,k->given,sol,micros);
+    if(!k->key_canon) return;
+    for(int i=0;i<N*N;i++) cs[i]=k->how.map[sol[canon_source(&k->how,i)]];
+    cache_fill(c,k->key_canon,CACHE_CANON,k->canon,cs,micros);
+}
+
+static void cache_report(SolutionCache* c){
+    fprintf(stderr,"cache: %llu hits (%.3f s of solving saved), %llu misses, %llu slots written;"
+            " %llu of %zu slots used\n", (unsigned long long)atomic_load(&c->hits),
+            (double)atomic_load(&c->saved_us)*1e-6, (unsigned long long)atomic_load(&c->misses),
+            (unsigned long long)atomic_load(&c->stores),
+            (unsigned long long)atomic_load(&c->head->used), c->cap);
+}
+
+// Record reader for the bulk modes: lines are handed out in place, without
+// their '\n' or "\r\n"; blank lines and '#' comments are skipped. Regular
+// files (including redirected stdin) are mapped whole and read sequentially
+// from the mapping; pipes and terminals go through a block buffer instead.
+// Input that starts with a bank header is read as fixed-size bank records.
+#define RECORD_READ (1u<<22)
+
+typedef struct {
+    const char* s;
+    size_t len;
+    long line;               // 1-based input line or bank record (0 inside a split-off part)
+    bool packed;             // a bank record: s points at its first byte
+} Record;
+
+typedef struct {
+    FILE* f;
+    const char* data;        // the mapping, or buf
+    char* buf;               // 2*RECORD_READ bytes when not mapped
+    size_t map_len;          // nonzero when this reader owns a mapping
+    size_t start;            // first byte of input in data
+    size_t have, pos;
+    bool eof;
+    bool skip;               // inside a line too long for the buffer, already returned
+    long line;
+    BankHeader bank;         // bank.size != 0 for bank input
+    size_t base;             // first record of a mapped bank
+    uint64_t left;           // bank records still to read
+    unsigned long long bytes;    // read so far (buffered mode)
+    double io_time;              // seconds spent in fread
+} RecordReader;
+
+static void reader_fill(RecordReader* r){
+    memmove(r->buf,r->buf+r->pos,r->have-r->pos);
+    r->have-=r->pos; r->pos=0;
+    size_t want = 2*RECORD_READ-r->have < RECORD_READ ? 2*RECORD_READ-r->have : RECORD_READ;
+    TRACE_SCOPE("fread");
+    double t0=now_seconds();
+    size_t got=fread(r->buf+r->have,1,want,r->f);
+    r->io_time += now_seconds()-t0;
+    r->bytes+=got; r->have+=got;
+    r->eof = got<want;
+}
+
+// Switches to bank records if the input starts with a bank header. A
+// mapping is cut to the header's count, so splits never look past it.
+static void reader_probe(RecordReader* r){
+    while(r->buf && !r->eof && r->have-r->pos<BANK_HEADER) reader_fill(r);
+    if(r->have-r->pos<8 || memcmp(r->data+r->pos,BANK_MAGIC,8)!=0) return;
+    if(r->have-r->pos<BANK_HEADER || !bank_header_get((const uint8_t*)r->data+r->pos,&r->bank)){
+        fputs("input: unsupported puzzle bank\n",stderr);
+        r->bank.size=0;
+        r->pos=r->have; r->eof=true;
+        return;
+    }
+    r->pos+=BANK_HEADER;
+    r->base=r->pos;
+    r->left = r->bank.count ? r->bank.count : UINT64_MAX;
+    if(r->map_len && (r->have-r->pos)/r->bank.size > r->left) r->have=r->pos+r->left*r->bank.size;
+}
+
+static bool reader_open(RecordReader* r, FILE* f){
+    memset(r,0,sizeof *r);
+    r->f=f;
+    int fd=fileno(f);
+    struct stat sb;
+    off_t off = fd>=0 ? lseek(fd,0,SEEK_CUR) : -1;
+    if(off>=0 && fstat(fd,&sb)==0 && S_ISREG(sb.st_mode) && sb.st_size>off){
+        void* m=mmap(NULL,(size_t)sb.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if(m!=MAP_FAILED){
+            posix_madvise(m,(size_t)sb.st_size,POSIX_MADV_SEQUENTIAL);
+            r->data=m;
+            r->map_len=r->have=(size_t)sb.st_size;
+            r->start=r->pos=(size_t)off;
+            r->eof=true;
+            reader_probe(r);
+            return true;
+        }
+    }
+    r->buf=malloc(2*RECORD_READ);
+    r->data=r->buf;
+    if(!r->buf) return false;
+    reader_probe(r);
+    return true;
+}
+
+static void reader_close(RecordReader* r){
+    if(r->map_len) munmap((void*)r->data,r->map_len);
+    free(r->buf);
+    r->buf=NULL; r->data=NULL; r->map_len=0;
+}
+
+// Bytes of input consumed so far.
+static unsigned long long reader_bytes(const RecordReader* r){
+    return r->buf ? r->bytes : r->pos-r->start;
+}
+
+// Input throughput line for stderr, given the run's wall time.
+static void reader_report(const RecordReader* r, double seconds){
+    double mib=(double)reader_bytes(r)/(1<<20);
+    fprintf(stderr,"input: %.1f MiB via %s (%.0f MiB/s", mib, r->buf ? "read" : "mmap",
+            seconds>0 ? mib/seconds : 0.0);
+    if(r->buf) fprintf(stderr,"; %.3f s in read", r->io_time);
+    fputs(")\n",stderr);
+}
+
+// Fills out[0..max) and returns the count, 0 only at end of input. The
+// records stay valid until the next call. A line that does not fit the
+// buffer comes back once, cut short, so callers reject it as malformed.
+static size_t reader_next(RecordReader* r, Record* out, size_t max){
+    size_t n=0;
+    for(;;){
+        while(r->bank.size && n<max && r->left && r->have-r->pos>=r->bank.size){
+            out[n++]=(Record){ r->data+r->pos, r->bank.size, ++r->line, true };
+            r->pos+=r->bank.size;
+            r->left--;
+        }
+        if(r->bank.size && r->have-r->pos<r->bank.size && r->eof) r->pos=r->have;   // cut-off tail
+        while(!r->bank.size && n<max && r->pos<r->have){
+            const char* p=r->data+r->pos;
+            const char* e=memchr(p,'\n',r->have-r->pos);
+            if(!e && !r->eof) break;
+            size_t len = e ? (size_t)(e-p) : r->have-r->pos;
+            r->pos += len + (e!=NULL);
+            if(r->skip){ r->skip=false; continue; }
+            r->line++;
+            if(len && p[len-1]=='\r') len--;
+            if(len==0 || p[0]=='#') continue;
+            out[n++]=(Record){ p, len, r->line, false };
+        }
+        if(n || (r->eof && r->pos==r->have) || (r->bank.size && !r->left)) return n;
+        if(r->pos==0 && r->have==2*RECORD_READ){
+            r->pos=r->have;
+            if(!r->skip){
+                r->skip=true;
+                out[n++]=(Record){ r->buf, r->have, ++r->line, false };
+                return n;
+            }
+            continue;
+        }
+        reader_fill(r);
+    }
+}
+
+static bool reader_line(RecordReader* r, Record* rec){
+    return reader_next(r,rec,1)==1;
+}
+
+// Moves a bank reader to record 'index' (0-based): a mapped bank seeks
+// straight there, a streamed one reads past the records before it.
+static void reader_seek(RecordReader* r, uint64_t index){
+    if(r->map_len){
+        size_t total=(r->have-r->base)/r->bank.size;
+        uint64_t i = index<total ? index : total;
+        r->pos=r->base+(size_t)i*r->bank.size;
+        r->line=(long)i;
+        r->left = r->bank.count ? r->bank.count-i : UINT64_MAX;
+        return;
+    }
+    Record skip[256];
+    while(index){
+        size_t k=reader_next(r,skip,index<256 ? (size_t)index : 256);
+        if(!k) break;
+        index-=k;
+    }
+}
+
+// Splits about 'bytes' of a mapped input, extended to the end of a line
+// (or cut to whole bank records), off the front of 'r' into 'part', a
+// reader over just that range. Returns false when the input is not mapped
+// or is used up.
+static bool reader_split(RecordReader* r, size_t bytes, RecordReader* part){
+    if(!r->map_len || r->pos>=r->have) return false;
+    size_t end = r->have-r->pos > bytes ? r->pos+bytes : r->have;
+    if(r->bank.size){
+        size_t whole=(end-r->pos)/r->bank.size;
+        end=r->pos+(whole ? whole : 1)*r->bank.size;
+        if(end>r->have) end=r->have;
+    } else if(end<r->have){
+        const char* nl=memchr(r->data+end-1,'\n',r->have-end+1);
+        end = nl ? (size_t)(nl-r->data)+1 : r->have;
+    }
+    *part=(RecordReader){ .data=r->data, .start=r->pos, .have=end, .pos=r->pos, .eof=true,
+                          .bank=r->bank, .base=r->pos, .left=UINT64_MAX };
+    r->pos=end;
+    return true;
+}
+
+// The puzzle of a record as byte cells: 81 characters of 1-9, 0 or '.',
+// or a bank record's packed cells.
+static bool record_cells(const Record* rec, uint8_t cell[N*N]){
+    if(rec->packed) return unpack_cells((const uint8_t*)rec->s+BANK_META,cell);
+    return rec->len==N*N && line_to_cells(rec->s,cell);
+}
+
+static bool parse_record(const Record* rec, Board* b){
+    uint8_t cell[N*N];
+    if(!record_cells(rec,cell)) return false;
+    int* g=&b->grid[0][0];
+    for(int i=0;i<N*N;i++) g[i]=cell[i];
+    return true;
+}
+
+// sudoku enum [-n MAX] [FILE]
+// Every solution of each input grid goes to stdout, one per line;
+// per-grid counts and rates go to stderr.
+static int mode_enum(int argc, char** argv){
+    unsigned long long limit=0;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-n")==0 && i+1<argc) limit=strtoull(argv[++i],NULL,10);
+        else path=argv[i];
+    }
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    Writer w;
+    RecordReader rd;
+    if(!reader_open(&rd,in) || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        reader_close(&rd);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+
+    Record rec;
+    while(reader_line(&rd,&rec)){
+        Board b;
+        if(!parse_record(&rec,&b)){
+            fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec.line);
+            continue;
+        }
+        double t0=now_seconds();
+        unsigned long long n = is_legal(&b) ? enumerate_solutions(&b,limit,&w) : 0;
+        double dt=now_seconds()-t0;
+        fprintf(stderr,"line %ld: %llu solution%s%s (%.3f s, %.0f/s)\n", rec.line, n,
+                n==1?"":"s", (limit && n==limit)?" (cap reached)":"", dt, dt>0 ? (double)n/dt : 0.0);
+    }
+    writer_close(&w);
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return 0;
+}
+
+// sudoku count [-e bands|dfs] [-t MB] [-H] [FILE]
+// Exact number of solutions of each input grid, one per line on stdout.
+// 'bands' (default) is the band/stack counter; 'dfs' is count_solutions_ex
+// with an MB-sized transposition table (0 turns it off). -H ends with
+// latency percentiles over all grids.
+static int mode_count(int argc, char** argv){
+    bool dfs=false, timed=false;
+    size_t tt_mb=64;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-e")==0 && i+1<argc){
+            const char* e=argv[++i];
+            if(strcmp(e,"bands")!=0 && strcmp(e,"dfs")!=0){
+                fputs("engine must be bands or dfs\n",stderr);
+                return 2;
+            }
+            dfs = strcmp(e,"dfs")==0;
+        }
+        else if(strcmp(argv[i],"-t")==0 && i+1<argc) tt_mb=strtoull(argv[++i],NULL,10);
+        else if(strcmp(argv[i],"-H")==0) timed=true;
+        else path=argv[i];
+    }
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    TransTable tt={0};
+    RecordReader rd;
+    LatHist* lat = timed ? calloc(1,sizeof *lat) : NULL;
+    if(!reader_open(&rd,in) || (dfs && tt_mb && !tt_init(&tt,tt_mb<<20)) || (timed && !lat)){
+        fputs("Out of memory.\n",stderr);
+        reader_close(&rd);
+        free(lat);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+
+    char num[40];
+    int rc=0;
+    Record rec;
+    while(reader_line(&rd,&rec)){
+        Board b;
+        if(!parse_record(&rec,&b)){
+            fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec.line);
+            continue;
+        }
+        uint64_t t0=lat_now();
+        if(dfs){
+            SolverStats st={0};
+            int n = is_legal(&b) ? count_solutions_ex(&b,INT_MAX,tt.e ? &tt : NULL,&st) : 0;
+            snprintf(num,sizeof num,"%d%s", n, n==INT_MAX ? "+" : "");
+            fprintf(stderr,"line %ld: %llu nodes", rec.line, st.nodes);
+            if(st.tt_probes)
+                fprintf(stderr,", tt %llu/%llu hits (%.1f%%), %llu stores, %llu evictions, %zu MiB",
+                        st.tt_hits, st.tt_probes, 100.0*(double)st.tt_hits/(double)st.tt_probes,
+                        st.tt_stores, st.tt_evictions, st.tt_bytes>>20);
+            fputc('\n',stderr);
+        } else {
+            bool ok;
+            u128 n=count_completions(&b,&ok);
+            if(!ok){ fprintf(stderr,"line %ld: out of memory\n", rec.line); rc=1; continue; }
+            u128_to_str(n,num);
+        }
+        uint64_t ns=lat_now()-t0;
+        if(lat) lat_record(lat,ns);
+        printf("%s\n", num);
+        fprintf(stderr,"line %ld: %s (%.3f s)\n", rec.line, num, (double)ns*1e-9);
+    }
+    if(lat){
+        lat_print(NULL,NULL);
+        lat_print(dfs ? "count" : "bands",lat);
+        free(lat);
+    }
+    tt_free(&tt);
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return rc;
+}
+
+// Write 'b' as an 81-character line ('.' for empty cells).
+static void put_grid_line(Writer* w, const Board* b){
+    char* line=writer_space(w,N*N+1);
+    board_to_line(b,line);
+    line[N*N]='\n';
+}
+
+/* Solve pipeline: a reader thread parses records into compact boards, solver
+   threads run solve_batch on them, and a writer thread prints results in
+   input order. The stages share one ring of batch slots. Each slot carries
+   a turn counter, 3*seq for "free for batch seq", 3*seq+1 for "parsed" and
+   3*seq+2 for "solved"; a stage waits for the turn it needs and publishes
+   the next one, so there are no locks. A full ring holds the reader back. */
+#define PIPE_BATCH 256
+#define PIPE_SLOTS 64
+
+typedef struct {
+    atomic_size_t turn;
+    size_t n;
+    uint8_t cell[PIPE_BATCH][N*N];   // 0 == empty; solutions are written back
+    bool ok[PIPE_BATCH];
+} PipeSlot;
+
+typedef struct {
+    PipeSlot* slot;                  // PIPE_SLOTS of them
+    RecordReader rd;
+    Writer* w;
+    int lanes;
+    bool scalar;
+    bool timed;                      // scalar, each solve_board into PipeSolver.lat
+    SolutionCache* cache;            // NULL: solve everything
+    atomic_size_t claim;             // next batch for a solver
+    atomic_size_t batches;           // batch count, valid once 'done' is set
+    atomic_bool done;
+} Pipeline;
+
+typedef struct {
+    Pipeline* p;
+    Board b[PIPE_BATCH];
+    bool ok[PIPE_BATCH];
+    uint16_t at[PIPE_BATCH];         // slot index of b[i]
+    CacheKey key[PIPE_BATCH];
+    CanonWork cw;
+    BatchStats st;
+    double busy;                     // seconds spent solving
+    LatHist lat;                     // with -H
+} PipeSolver;
+
+static void pipe_pause(unsigned* spins){
+    if(++*spins<64) return;
+    if(*spins<1024){ sched_yield(); return; }
+    struct timespec ts={0,50000};
+    nanosleep(&ts,NULL);
+}
+
+// Waits until batch 'seq' reaches 'want'; false if input ended before it.
+static bool pipe_wait(Pipeline* p, size_t seq, size_t want){
+    PipeSlot* sl=&p->slot[seq%PIPE_SLOTS];
+    unsigned spins=0;
+    if(atomic_load_explicit(&sl->turn,memory_order_acquire)==want) return true;
+    TRACE_SCOPE("stall");
+    while(atomic_load_explicit(&sl->turn,memory_order_acquire)!=want){
+        if(atomic_load_explicit(&p->done,memory_order_acquire)
+           && seq>=atomic_load_explicit(&p->batches,memory_order_relaxed)) return false;
+        pipe_pause(&spins);
+    }
+    return true;
+}
+
+static void* pipe_reader(void* arg){
+    Pipeline* p=arg;
+    Record rec[PIPE_BATCH];
+    size_t seq=0;
+    bool more=true;
+    trace_name("reader");
+    while(more){
+        PipeSlot* sl=&p->slot[seq%PIPE_SLOTS];
+        unsigned spins=0;
+        if(atomic_load_explicit(&sl->turn,memory_order_acquire)!=3*seq){
+            TRACE_SCOPE("stall");
+            while(atomic_load_explicit(&sl->turn,memory_order_acquire)!=3*seq) pipe_pause(&spins);
+        }
+        TRACE_SCOPE("parse batch");
+        size_t n=0;
+        while(n<PIPE_BATCH){
+            size_t k=reader_next(&p->rd,rec,PIPE_BATCH-n);
+            if(!k){ more=false; break; }
+            for(size_t i=0;i<k;i++){
+                if(!record_cells(&rec[i],sl->cell[n])){
+                    fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec[i].line);
+                    continue;
+                }
+                n++;
+            }
+        }
+        if(!n) break;
+        sl->n=n;
+        atomic_store_explicit(&sl->turn,3*seq+1,memory_order_release);
+        seq++;
+    }
+    atomic_store_explicit(&p->batches,seq,memory_order_relaxed);
+    atomic_store_explicit(&p->done,true,memory_order_release);
+    return NULL;
+}
+
+static void* pipe_solver(void* arg){
+    PipeSolver* ps=arg;
+    Pipeline* p=ps->p;
+    trace_name("solver");
+    for(;;){
+        size_t seq=atomic_fetch_add(&p->claim,1);
+        if(!pipe_wait(p,seq,3*seq+1)) break;
+        PipeSlot* sl=&p->slot[seq%PIPE_SLOTS];
+        TRACE_SCOPE("solve batch");
+        double t0=now_seconds();
+        // cache hits are answered in the slot; the rest go on to b[0..n)
+        size_t n=0;
+        for(size_t i=0;i<sl->n;i++){
+            if(p->cache && cache_lookup(p->cache,sl->cell[i],sl->cell[i],&ps->key[n],&ps->cw)){
+                sl->ok[i]=sl->cell[i][0]!=0;
+                ps->st.puzzles++; ps->st.cached++;
+                if(!sl->ok[i]) ps->st.unsolvable++;
+                continue;
+            }
+            ps->at[n]=(uint16_t)i;
+            for(int c=0;c<N*N;c++) ps->b[n].grid[c/N][c%N]=sl->cell[i][c];
+            n++;
+        }
+        double t1=now_seconds();
+        if(p->scalar){
+            for(size_t i=0;i<n;i++){
+                uint64_t s0 = p->timed ? lat_now() : 0;
+                ps->ok[i] = is_legal(&ps->b[i]) && solve_board(&ps->b[i]);
+                if(p->timed) lat_record(&ps->lat,lat_now()-s0);
+                ps->st.puzzles++; ps->st.searched++;
+                if(!ps->ok[i]) ps->st.unsolvable++;
+            }
+        } else solve_batch(ps->b,ps->ok,n,p->lanes,&ps->st);
+        uint32_t micros = n ? (uint32_t)((now_seconds()-t1)*1e6/(double)n) : 0;
+        for(size_t i=0;i<n;i++){
+            uint8_t* cell=sl->cell[ps->at[i]];
+            for(int c=0;c<N*N;c++) cell[c]=(uint8_t)ps->b[i].grid[c/N][c%N];
+            sl->ok[ps->at[i]]=ps->ok[i];
+            if(p->cache) cache_store(p->cache,&ps->key[i],ps->ok[i] ? cell : NULL,micros);
+        }
+        ps->busy += now_seconds()-t0;
+        atomic_store_explicit(&sl->turn,3*seq+2,memory_order_release);
+    }
+    return NULL;
+}
+
+static void* pipe_writer(void* arg){
+    Pipeline* p=arg;
+    trace_name("writer");
+    for(size_t seq=0; pipe_wait(p,seq,3*seq+2); seq++){
+        PipeSlot* sl=&p->slot[seq%PIPE_SLOTS];
+        TRACE_SCOPE("format batch");
+        for(size_t i=0;i<sl->n;i++){
+            if(!sl->ok[i]){ writer_put(p->w,"no solution\n",12); continue; }
+            char* line=writer_space(p->w,N*N+1);
+            cells_to_line(sl->cell[i],line);
+            line[N*N]='\n';
+        }
+        atomic_store_explicit(&sl->turn,3*(seq+PIPE_SLOTS),memory_order_release);
+    }
+    return NULL;
+}
+
+// sudoku solve [-j N] [-l 8|16|32] [-s] [-H] [-c CACHE] [FILE]
+// One solution line per input grid ("no solution" when there is none), in
+// input order. N solver threads (default: all CPUs) take batches between a
+// reader and a writer thread; each batch goes through solve_batch LANES at
+// a time (default 32), or with -s one grid at a time through solve_board.
+// With -c, grids found in the solution cache CACHE (created if missing)
+// skip the solver, and solved ones are added to it. -H times every
+// solve_board call (so implies -s) and prints latency percentiles.
+static int mode_solve(int argc, char** argv){
+    int lanes=32, threads=default_threads();
+    bool scalar=false, timed=false;
+    const char* path=NULL;
+    const char* cache_path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-l")==0 && i+1<argc) lanes=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-j")==0 && i+1<argc) threads=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-s")==0) scalar=true;
+        else if(strcmp(argv[i],"-H")==0) scalar=timed=true;
+        else if(strcmp(argv[i],"-c")==0 && i+1<argc) cache_path=argv[++i];
+        else path=argv[i];
+    }
+    if(lanes!=8 && lanes!=16 && lanes!=32){
+        fputs("lanes must be 8, 16 or 32\n",stderr);
+        return 2;
+    }
+    if(threads<1) threads=1;
+    if(threads>64) threads=64;
+    SolutionCache cache;
+    if(cache_path && !cache_open(&cache,cache_path,CACHE_SLOTS)) return 1;
+    FILE* in=open_input(path);
+    if(!in){
+        if(cache_path) cache_close(&cache);
+        return 1;
+    }
+    Writer w;
+    Pipeline p={ .w=&w, .lanes=lanes, .scalar=scalar, .timed=timed, .cache = cache_path ? &cache : NULL };
+    p.slot=malloc(PIPE_SLOTS*sizeof *p.slot);
+    PipeSolver* ps=calloc((size_t)threads,sizeof *ps);
+    bool rd_ok=reader_open(&p.rd,in);
+    if(!p.slot || !ps || !rd_ok || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        if(rd_ok) reader_close(&p.rd);
+        if(cache_path) cache_close(&cache);
+        free(p.slot); free(ps);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+    for(size_t i=0;i<PIPE_SLOTS;i++) atomic_init(&p.slot[i].turn,3*i);
+    atomic_init(&p.claim,0);
+    atomic_init(&p.batches,0);
+    atomic_init(&p.done,false);
+    double t0=now_seconds();
+
+    // solvers first: without one nothing would drain the ring
+    pthread_t reader, tid[64];
+    int started=0, rc=0;
+    for(int i=0;i<threads;i++){
+        ps[i].p=&p;
+        if(pthread_create(&tid[i],NULL,pipe_solver,&ps[i])!=0) break;
+        started++;
+    }
+    bool reading = started>0 && pthread_create(&reader,NULL,pipe_reader,&p)==0;
+    if(!reading){
+        fputs("Cannot start threads.\n",stderr);
+        rc=1;
+        atomic_store(&p.done,true);          // zero batches: solvers stop at once
+    }
+    pipe_writer(&p);                         // this thread is the ordered writer
+    if(reading) pthread_join(reader,NULL);
+    for(int i=0;i<started;i++) pthread_join(tid[i],NULL);
+    writer_close(&w);
+    double dt=now_seconds()-t0;
+
+    BatchStats st={0};
+    double busy=0;
+    LatHist* lat = timed ? calloc(1,sizeof *lat) : NULL;
+    for(int i=0;i<started;i++){
+        if(lat) lat_merge(lat,&ps[i].lat);
+        st.puzzles += ps[i].st.puzzles; st.propagated += ps[i].st.propagated;
+        st.searched += ps[i].st.searched; st.unsolvable += ps[i].st.unsolvable;
+        st.cached += ps[i].st.cached;
+        busy += ps[i].busy;
+        canon_work_free(&ps[i].cw);
+    }
+    fprintf(stderr,"%llu puzzles: %llu cached, %llu by propagation, %llu searched, %llu unsolvable"
+            " (%.3f s, %.0f/s; %d solver%s, %.3f s busy)\n", st.puzzles, st.cached, st.propagated,
+            st.searched, st.unsolvable, dt, dt>0 ? (double)st.puzzles/dt : 0.0,
+            started, started==1?"":"s", busy);
+    reader_report(&p.rd,dt);
+    if(lat){
+        lat_print(NULL,NULL);
+        lat_print("solve",lat);
+        free(lat);
+    }
+    if(cache_path){
+        cache_report(&cache);
+        cache_close(&cache);
+    }
+    reader_close(&p.rd);
+    free(p.slot); free(ps);
+    if(in!=stdin) fclose(in);
+    return rc;
+}
+
+#define VALIDATE_BATCH 16384
+#define VALIDATE_SPLIT (8u<<20)     // bytes of mapped input per worker and round
+
+static const char* const unit_kind[3] = { "row", "col", "box" };
+
+typedef struct {
+    RecordReader* rd;
+    bool quiet, ok;
+    Record rec[VALIDATE_BATCH];
+    const char* s[VALIDATE_BATCH];
+    char text[VALIDATE_BATCH][N*N];     // bank records, reformatted as lines
+    Verdict v[VALIDATE_BATCH];
+    char* out;                      // verdict text not yet written
+    size_t len, cap;
+    unsigned long long tally[4];
+} ValidateJob;
+
+// Checks the next batch of records from job->rd and appends their verdicts
+// to job->out; false at end of input or when out of memory.
+static bool validate_step(ValidateJob* job){
+    static const char bad_record[N*N+1] =           // any non-cell character checks as malformed
+        "################################################################################"
+        "#";
+    TRACE_SCOPE("validate batch");
+    size_t n=reader_next(job->rd,job->rec,VALIDATE_BATCH);
+    if(!n) return false;
+    for(size_t i=0;i<n;i++){
+        const Record* rec=&job->rec[i];
+        uint8_t cell[N*N];
+        if(!rec->packed) job->s[i] = rec->len==N*N ? rec->s : bad_record;
+        else if(!unpack_cells((const uint8_t*)rec->s+BANK_META,cell)) job->s[i]=bad_record;
+        else { cells_to_line(cell,job->text[i]); job->s[i]=job->text[i]; }
+    }
+    check_records(job->s,n,job->v);
+    if(!job->quiet && job->cap-job->len < 16*n){
+        size_t cap = job->cap*2 > job->len+16*n ? job->cap*2 : job->len+16*n;
+        char* out=realloc(job->out,cap);
+        if(!out){ job->ok=false; return false; }
+        job->out=out; job->cap=cap;
+    }
+    for(size_t i=0;i<n;i++){
+        const Verdict* v=&job->v[i];
+        job->tally[v->result]++;
+        if(job->quiet) continue;
+        char* o=job->out+job->len;
+        switch(v->result){
+            case CHECK_SOLVED: memcpy(o,"ok\n",3); job->len+=3; break;
+            case CHECK_OPEN: memcpy(o,"open\n",5); job->len+=5; break;
+            case CHECK_CONFLICT:
+                job->len += (size_t)snprintf(o,16,"%s %d\n", unit_kind[v->unit/N], v->unit%N+1);
+                break;
+            default: memcpy(o,"malformed\n",10); job->len+=10; break;
+        }
+    }
+    return true;
+}
+
+static void* validate_worker(void* arg){
+    ValidateJob* job=arg;
+    trace_name("validator");
+    while(validate_step(job)) {}
+    return NULL;
+}
+
+// sudoku validate [-q] [-j N] [FILE]
+// One verdict per record: "ok", "open" (legal but has empty cells), the
+// first unit with a repeated digit ("row 3", "col 9", "box 1"), or
+// "malformed". -q prints only the totals, which go to stderr either way.
+// A mapped file is cut into line-aligned pieces checked on N threads
+// (default: all CPUs); stdin from a pipe is checked on this thread.
+static int mode_validate(int argc, char** argv){
+    bool quiet=false;
+    int threads=default_threads();
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-q")==0) quiet=true;
+        else if(strcmp(argv[i],"-j")==0 && i+1<argc) threads=atoi(argv[++i]);
+        else path=argv[i];
+    }
+    if(threads<1) threads=1;
+    if(threads>64) threads=64;
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    Writer w;
+    RecordReader rd;
+    bool rd_ok=reader_open(&rd,in);
+    if(!rd.map_len) threads=1;
+    ValidateJob* job=calloc((size_t)threads,sizeof *job);
+    if(!job || !rd_ok || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        if(rd_ok) reader_close(&rd);
+        free(job);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+    for(int i=0;i<threads;i++){ job[i].quiet=quiet; job[i].ok=true; }
+    double t0=now_seconds();
+
+    if(threads==1){
+        job[0].rd=&rd;
+        while(validate_step(&job[0])){
+            writer_put(&w,job[0].out,job[0].len);
+            job[0].len=0;
+        }
+    } else {
+        RecordReader part[64];
+        pthread_t tid[64];
+        int k;
+        do {
+            for(k=0;k<threads && reader_split(&rd,VALIDATE_SPLIT,&part[k]);k++) job[k].rd=&part[k];
+            int started=0;       // pieces 0..started-1 got a thread each
+            while(started<k-1 && pthread_create(&tid[started],NULL,validate_worker,&job[started])==0) started++;
+            for(int i=started;i<k;i++) validate_worker(&job[i]);   // the rest run here
+            for(int i=0;i<k;i++){
+                if(i<started) pthread_join(tid[i],NULL);
+                writer_put(&w,job[i].out,job[i].len);
+                job[i].len=0;
+            }
+        } while(k==threads);
+    }
+    writer_close(&w);
+    double dt=now_seconds()-t0;
+
+    unsigned long long tally[4]={0};
+    bool ok=true;
+    for(int i=0;i<threads;i++){
+        for(int r=0;r<4;r++) tally[r]+=job[i].tally[r];
+        ok = ok && job[i].ok;
+        free(job[i].out);
+    }
+    if(!ok) fputs("Out of memory.\n",stderr);
+    unsigned long long total=tally[0]+tally[1]+tally[2]+tally[3];
+    fprintf(stderr,"%llu records: %llu ok, %llu open, %llu conflict, %llu malformed"
+            " (%.3f s, %.0f/s; %d thread%s)\n", total, tally[CHECK_SOLVED], tally[CHECK_OPEN],
+            tally[CHECK_CONFLICT], tally[CHECK_MALFORMED], dt, dt>0 ? (double)total/dt : 0.0,
+            threads, threads==1?"":"s");
+    reader_report(&rd,dt);
+    reader_close(&rd);
+    free(job);
+    if(in!=stdin) fclose(in);
+    return ok ? 0 : 1;
+}
+
+static const char* const bank_level[4] = { "-", "easy", "medium", "hard" };
+
+// Fills the rating and solution fields of bank record 'out' for the puzzle
+// 'cell': the rating is the node count of a search for a second solution,
+// the solution all empty when there is none.
+static void bank_rate(const uint8_t cell[N*N], uint8_t* out){
+    Board b;
+    int* g=&b.grid[0][0];
+    for(int i=0;i<N*N;i++) g[i]=cell[i];
+    uint8_t sol[N*N]={0};
+    unsigned long long nodes=0;
+    if(is_legal(&b)){
+        SolverStats st={0};
+        count_solutions_ex(&b,2,NULL,&st);
+        nodes=st.nodes;
+        if(solve_board(&b)) for(int i=0;i<N*N;i++) sol[i]=(uint8_t)g[i];
+    }
+    put_le(out+2, nodes<0xFFFF ? nodes : 0xFFFF, 2);
+    pack_cells(sol,out+BANK_META+BANK_CELLS);
+}
+
+// sudoku pack [-s] [-d easy|medium|hard] [FILE]
+// Grid lines (or another bank) to a puzzle bank on stdout. -s solves each
+// grid and stores its solution and rating; -d tags every record with a
+// difficulty. The header gets the record count when stdout can seek back.
+static int mode_pack(int argc, char** argv){
+    bool solutions=false;
+    int level=-1;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-s")==0) solutions=true;
+        else if(strcmp(argv[i],"-d")==0 && i+1<argc) level=(int)parse_difficulty(argv[++i])+1;
+        else path=argv[i];
+    }
+    if(isatty(STDOUT_FILENO)){
+        fputs("Not writing a puzzle bank to a terminal.\n",stderr);
+        return 2;
+    }
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    Writer w;
+    RecordReader rd;
+    bool rd_ok=reader_open(&rd,in);
+    if(!rd_ok || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        if(rd_ok) reader_close(&rd);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+    BankHeader h={ .flags = solutions ? BANK_SOLUTIONS : 0 };
+    h.size=bank_record_size(h.flags);
+    uint8_t head[BANK_HEADER];
+    bank_header_put(head,&h);
+    off_t at = fcntl(STDOUT_FILENO,F_GETFL)&O_APPEND ? -1 : ftello(stdout);
+    writer_put(&w,(const char*)head,BANK_HEADER);
+    double t0=now_seconds();
+
+    Record rec[1024];
+    size_t k;
+    unsigned long long rejected=0;
+    while((k=reader_next(&rd,rec,1024))>0){
+        for(size_t i=0;i<k;i++){
+            uint8_t cell[N*N];
+            if(!record_cells(&rec[i],cell)){
+                fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec[i].line);
+                rejected++;
+                continue;
+            }
+            uint8_t* o=(uint8_t*)writer_space(&w,h.size);
+            int clues=0;
+            for(int c=0;c<N*N;c++) clues+=cell[c]!=0;
+            o[0]=(uint8_t)clues;
+            if(rec[i].packed) memcpy(o+1,rec[i].s+1,BANK_META-1);   // keep difficulty and rating
+            else memset(o+1,0,BANK_META-1);
+            if(level>=0) o[1]=(uint8_t)level;
+            pack_cells(cell,o+BANK_META);
+            if(solutions) bank_rate(cell,o);
+            h.count++;
+        }
+    }
+    writer_close(&w);
+    if(at>=0 && fseeko(stdout,at,SEEK_SET)==0){
+        bank_header_put(head,&h);
+        fwrite(head,1,BANK_HEADER,stdout);
+        fflush(stdout);
+    }
+    double dt=now_seconds()-t0;
+    fprintf(stderr,"%llu records of %u bytes, %llu rejected (%.3f s, %.0f/s)\n",
+            (unsigned long long)h.count, h.size, rejected, dt, dt>0 ? (double)h.count/dt : 0.0);
+    reader_report(&rd,dt);
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return 0;
+}
+
+// sudoku unpack [-s] [-m] [-r FIRST[:COUNT]] [FILE]
+// Puzzle bank to grid lines: the puzzles, or with -s the stored solutions
+// ("no solution" where there is none). -m appends each record's clues,
+// difficulty and rating. -r starts at record FIRST (0-based) and stops
+// after COUNT records.
+static int mode_unpack(int argc, char** argv){
+    bool solutions=false, meta=false;
+    unsigned long long first=0, limit=ULLONG_MAX;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-s")==0) solutions=true;
+        else if(strcmp(argv[i],"-m")==0) meta=true;
+        else if(strcmp(argv[i],"-r")==0 && i+1<argc){
+            char* end=NULL;
+            first=strtoull(argv[++i],&end,10);
+            if(*end==':') limit=strtoull(end+1,NULL,10);
+        }
+        else path=argv[i];
+    }
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    Writer w;
+    RecordReader rd;
+    bool rd_ok=reader_open(&rd,in);
+    if(!rd_ok || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        if(rd_ok) reader_close(&rd);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+    int rc=0;
+    if(!rd.bank.size){
+        fputs("Input is not a puzzle bank.\n",stderr);
+        rc=1;
+    } else if(solutions && !(rd.bank.flags&BANK_SOLUTIONS)){
+        fputs("This bank has no solutions.\n",stderr);
+        rc=1;
+    }
+    double t0=now_seconds();
+    unsigned long long done=0, bad=0;
+    if(rc==0){
+        reader_seek(&rd,first);
+        Record rec[1024];
+        size_t k;
+        while(done<limit && (k=reader_next(&rd,rec,limit-done<1024 ? (size_t)(limit-done) : 1024))>0){
+            for(size_t i=0;i<k;i++){
+                const uint8_t* r=(const uint8_t*)rec[i].s;
+                uint8_t cell[N*N];
+                if(!unpack_cells(r+BANK_META+(solutions ? BANK_CELLS : 0),cell)){
+                    fprintf(stderr,"record %ld: cell out of range\n", rec[i].line-1);
+                    bad++;
+                    continue;
+                }
+                int filled=0;
+                for(int c=0;c<N*N;c++) filled+=cell[c]!=0;
+                if(solutions && !filled) writer_put(&w,"no solution",11);
+                else cells_to_line(cell,writer_space(&w,N*N));
+                if(meta){
+                    char tail[32];
+                    int n=snprintf(tail,sizeof tail," %d %s %d", r[0], bank_level[r[1]&3],
+                                   (int)get_le(r+2,2));
+                    writer_put(&w,tail,(size_t)n);
+                }
+                writer_put(&w,"\n",1);
+            }
+            done+=k;
+        }
+    }
+    writer_close(&w);
+    double dt=now_seconds()-t0;
+    if(rc==0){
+        fprintf(stderr,"%llu records from %llu", done, first);
+        if(rd.bank.count) fprintf(stderr," of %llu", (unsigned long long)rd.bank.count);
+        fprintf(stderr,", %llu bad (%.3f s, %.0f/s)\n", bad, dt, dt>0 ? (double)done/dt : 0.0);
+        reader_report(&rd,dt);
+    }
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return rc;
+}
+
+#define CANON_CHUNK 65536
+
+typedef struct {
+    const Board* in;
+    Board* out;
+    size_t n;
+    bool ok;
+} CanonJob;
+
+static void* canon_worker(void* arg){
+    CanonJob* job=arg;
+    CanonWork cw={0};
+    trace_name("canon");
+    TRACE_SCOPE("canon chunk");
+    job->ok=true;
+    for(size_t i=0;i<job->n && job->ok;i++) job->ok=canon_form(&job->in[i],&job->out[i],&cw,NULL);
+    canon_work_free(&cw);
+    return NULL;
+}
+
+// Canonicalize in[0..n) into out[] on up to 'threads' threads.
+static bool canon_batch(const Board* in, Board* out, size_t n, int threads){
+    if(threads<1) threads=1;
+    CanonJob job[64];
+    pthread_t tid[64];
+    bool spawned[64];
+    if(threads>64) threads=64;
+    size_t per=(n+(size_t)threads-1)/(size_t)threads;
+    int started=0;
+    for(int i=0;i<threads;i++){
+        size_t lo=(size_t)i*per;
+        if(lo>=n) break;
+        job[i]=(CanonJob){ in+lo, out+lo, lo+per>n ? n-lo : per, false };
+        spawned[i] = i<threads-1 && pthread_create(&tid[i],NULL,canon_worker,&job[i])==0;
+        if(!spawned[i]) canon_worker(&job[i]);      // last slice (or a failed spawn) runs here
+        started=i+1;
+    }
+    bool ok=true;
+    for(int i=0;i<started;i++){
+        if(spawned[i]) pthread_join(tid[i],NULL);
+        ok = ok && job[i].ok;
+    }
+    return ok;
+}
+
+// sudoku canon [-j N] [FILE]       canonical (minlex) form of each grid
+// sudoku dedup [-c] [-j N] [FILE]  drop grids isomorphic to an earlier one;
+//                                  with -c survivors are written canonical
+// Grids are canonicalized in chunks on N threads (default: all CPUs);
+// output keeps input order.
+static int canon_or_dedup(int argc, char** argv, bool dedup){
+    bool print_canon=!dedup;
+    int threads=default_threads();
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(dedup && strcmp(argv[i],"-c")==0) print_canon=true;
+        else if(strcmp(argv[i],"-j")==0 && i+1<argc) threads=atoi(argv[++i]);
+        else path=argv[i];
+    }
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    Writer w;
+    RecordReader rd;
+    Board* raw=malloc(CANON_CHUNK*sizeof *raw);
+    Board* can=malloc(CANON_CHUNK*sizeof *can);
+    bool rd_ok=reader_open(&rd,in);
+    if(!raw || !can || !rd_ok || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        if(rd_ok) reader_close(&rd);
+        free(raw); free(can);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+    GridSet seen={0};
+    unsigned long long total=0, unique=0;
+    int rc=0;
+    double t0=now_seconds();
+
+    Record rec;
+    bool more=true;
+    while(more && rc==0){
+        size_t n=0;
+        while(n<CANON_CHUNK && (more=reader_line(&rd,&rec))){
+            if(!parse_record(&rec,&raw[n])){
+                fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec.line);
+                continue;
+            }
+            n++;
+        }
+        if(!canon_batch(raw,can,n,threads)){ fputs("Out of memory.\n",stderr); rc=1; break; }
+        for(size_t i=0;i<n;i++){
+            total++;
+            if(dedup){
+                PackedGrid p=pack_grid(&can[i]);
+                int added=gridset_add(&seen,&p);
+                if(added<0){ fputs("Out of memory.\n",stderr); rc=1; break; }
+                if(!added) continue;
+                unique++;
+            }
+            put_grid_line(&w, print_canon ? &can[i] : &raw[i]);
+        }
+    }
+    writer_close(&w);
+    double dt=now_seconds()-t0;
+    if(dedup) fprintf(stderr,"%llu grids, %llu unique, %llu duplicates", total, unique, total-unique);
+    else fprintf(stderr,"%llu grids", total);
+    fprintf(stderr," (%.3f s, %.0f/s)\n", dt, dt>0 ? (double)total/dt : 0.0);
+    free(seen.e);
+    free(raw); free(can);
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return rc;
+}
+
+static int mode_canon(int argc, char** argv){ return canon_or_dedup(argc,argv,false); }
+static int mode_dedup(int argc, char** argv){ return canon_or_dedup(argc,argv,true); }
+
+// Isomorph expansion works on a layout at a time: the seed is gathered once
+// through the layout's table, then each digit renaming only swaps the
+// 16-entry cell-to-character table used to print it.
+typedef void (*ExpandLineFn)(const uint8_t* cells, const char tbl[16], char* out);
+
+static void expand_line_scalar(const uint8_t* cells, const char tbl[16], char* out){
+    for(int i=0;i<N*N;i++) out[i]=tbl[cells[i]];
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("ssse3")))
+static void expand_line_ssse3(const uint8_t* cells, const char tbl[16], char* out){
+    __m128i t=_mm_loadu_si128((const __m128i*)tbl);
+    for(int i=0;i<80;i+=16){
+        __m128i c=_mm_loadu_si128((const __m128i*)(cells+i));
+        _mm_storeu_si128((__m128i*)(out+i),_mm_shuffle_epi8(t,c));
+    }
+    out[80]=tbl[cells[80]];
+}
+#endif
+
+static ExpandLineFn expand_line_fn(void){
+#ifdef HAVE_X86_SIMD
+    if(__builtin_cpu_supports("ssse3")) return expand_line_ssse3;
+#endif
+    return expand_line_scalar;
+}
+
+// Next permutation in lexicographic order; wraps to ascending and returns
+// false after the last one.
+static bool next_perm(uint8_t* a, int n){
+    int i=n-2;
+    while(i>=0 && a[i]>=a[i+1]) i--;
+    if(i>=0){
+        int j=n-1;
+        while(a[j]<=a[i]) j--;
+        uint8_t t=a[i]; a[i]=a[j]; a[j]=t;
+    }
+    for(int l=i+1,r=n-1;l<r;l++,r--){ uint8_t t=a[l]; a[l]=a[r]; a[r]=t; }
+    return i>=0;
+}
+
+// Next renaming of the first m ordinals; the rest keep their values in
+// ascending order (reversing them makes next_perm step past all their
+// orders at once).
+static bool next_renaming(uint8_t* q, int m){
+    for(int l=m,r=N-1;l<r;l++,r--){ uint8_t t=q[l]; q[l]=q[r]; q[r]=t; }
+    return next_perm(q,N);
+}
 
-#define N 9
-#define BOX 3
-#define ALL ((1<<9)-1)
+// Writes up to 'count' isomorphs of 'seed', walking transforms from index
+// 'start'. Renamings that differ only on digits the seed does not use give
+// the same grid, so those digits always go to the leftover values in
+// increasing order. With 'seen' set, grids already in it are skipped as
+// well (needed only for seeds with a nontrivial automorphism). Returns the
+// number written, or -1 if 'seen' ran out of memory.
+static long long expand_isomorphs(const Board* seed, uint64_t start, unsigned long long count,
+                                  Writer* w, GridSet* seen){
+    static ExpandLineFn line_fn;
+    if(!line_fn) line_fn=expand_line_fn();
+    uint8_t in[N*N], cells[N*N], src[N*N], digit[N+1];
+    uint8_t ord[N], q[N];    // q[j] is the new value of digit ord[j]; used digits first
+    int m=0;
+    unsigned used=0;
+    for(int i=0;i<N*N;i++){ in[i]=(uint8_t)seed->grid[i/N][i%N]; used |= 1u<<in[i]; }
+    for(int d=1;d<=N;d++) if(used&(1u<<d)) ord[m++]=(uint8_t)d;
+    for(int d=1,k=m;d<=N;d++) if(!(used&(1u<<d))) ord[k++]=(uint8_t)d;
 
-typedef struct {
-    int grid[N][N];       // 0 == empty, 1..9 == value
-} Board;
+    uint64_t layout=start/DIGIT_PERMS;
+    transform_digits(start%DIGIT_PERMS,digit);
+    for(int j=0;j<N;j++) q[j]=digit[ord[j]];
+    for(int j=m+1;j<N;j++)                           // canonical order of the unused tail
+        for(int k=j;k>m && q[k]<q[k-1];k--){ uint8_t t=q[k]; q[k]=q[k-1]; q[k-1]=t; }
+    long long n=0;
+    char tbl[16]={'.'};
+    while((unsigned long long)n<count && layout<LAYOUTS){
+        transform_layout(layout,src);
+        for(int i=0;i<N*N;i++) cells[i]=in[src[i]];
+        do {
+            for(int j=0;j<N;j++) digit[ord[j]]=q[j];
+            for(int d=1;d<=N;d++) tbl[d]=(char)('0'+digit[d]);
+            if(seen){
+                PackedGrid p={{0}};
+                for(int i=0;i<N*N;i++) p.w[i/16] |= (uint64_t)digit[cells[i]] << (4*(i%16));
+                int added=gridset_add(seen,&p);
+                if(added<0) return -1;
+                if(!added) continue;
+            }
+            char* out=writer_space(w,N*N+1);
+            line_fn(cells,tbl,out);
+            out[N*N]='\n';
+            n++;
+        } while((unsigned long long)n<count && next_renaming(q,m));
+        if((unsigned long long)n<count) layout++;
+    }
+    return n;
+}
+
+// sudoku expand [-n COUNT] [-s START] [-u] [FILE]
+// Each input grid is a seed; up to COUNT of its isomorphs (default one
+// million) go to stdout, starting at transform index START (0 is the seed
+// itself). -u also drops repeats caused by symmetric seeds.
+static int mode_expand(int argc, char** argv){
+    unsigned long long count=1000000, start=0;
+    bool unique=false;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-n")==0 && i+1<argc) count=strtoull(argv[++i],NULL,10);
+        else if(strcmp(argv[i],"-s")==0 && i+1<argc) start=strtoull(argv[++i],NULL,10);
+        else if(strcmp(argv[i],"-u")==0) unique=true;
+        else path=argv[i];
+    }
+    if(start>=TRANSFORM_COUNT){
+        fprintf(stderr,"start index must be below %llu\n", TRANSFORM_COUNT);
+        return 2;
+    }
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    Writer w;
+    RecordReader rd;
+    if(!reader_open(&rd,in) || !writer_open(&w,stdout)){
+        fputs("Out of memory.\n",stderr);
+        reader_close(&rd);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+
+    int rc=0;
+    Record rec;
+    while(reader_line(&rd,&rec)){
+        Board b;
+        if(!parse_record(&rec,&b)){
+            fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec.line);
+            continue;
+        }
+        GridSet seen={0};
+        double t0=now_seconds();
+        long long n=expand_isomorphs(&b,start,count,&w,unique ? &seen : NULL);
+        double dt=now_seconds()-t0;
+        free(seen.e);
+        if(n<0){ fputs("Out of memory.\n",stderr); rc=1; break; }
+        fprintf(stderr,"line %ld: %lld isomorph%s (%.3f s, %.0f/s)\n", rec.line, n,
+                n==1?"":"s", dt, dt>0 ? (double)n/dt : 0.0);
+    }
+    writer_close(&w);
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return rc;
+}
+
+/* ------------------------- Worst-case search ------------------------- */
+
+// sudoku hunt: a local search over puzzles for the ones an engine finds
+// hardest. A chain starts from a seed puzzle and keeps proposing
+// neighbours: a given moved to an empty cell, dropped, added back, or set
+// to another digit. A neighbour counts only if its solution is still
+// unique. It is accepted when it costs no less than (1-T) times the current
+// one (threshold accepting, no libm needed), with T cooling from 0.3 to 0
+// over the chain, so early steps can walk downhill out of a local maximum
+// and late ones only climb. Every candidate may enter the shared corpus
+// of the KEEP costliest puzzles, one per isomorphism class.
+typedef enum { HUNT_SOLVE, HUNT_COUNT, HUNT_LANES } HuntEngine;
+
+static const char* const hunt_engine_name[] = { "solve", "count", "lanes" };
 
 typedef struct {
-    unsigned row[N], col[N], box[N];
-} Masks;
+    uint8_t cell[N*N];
+    Board canon;                     // class key
+    double cost;
+} HuntEntry;
 
-static inline int box_index(int r, int c){ return (r/BOX)*BOX + (c/BOX); }
-static inline int popcount9(unsigned x){ return __builtin_popcount(x); }
-static inline int lsb_index(unsigned x){ return __builtin_ctz(x); }
+typedef struct {
+    HuntEngine engine;
+    bool timed;                      // cost in ns (best of 3) rather than nodes
+    long iters;                      // per chain
+    int chains;
+    int keep;
+    uint64_t seed;
+    const uint8_t (*start)[N*N];     // seed puzzles, cycled over the chains
+    size_t nstart;
+    atomic_int next_chain;
+    pthread_mutex_t lock;            // guards the corpus
+    HuntEntry* best;                 // min-heap on cost, 'kept' of 'keep'
+    int kept;
+    double seed_max;                 // costliest seed, for comparison
+    atomic_ullong tried, accepted, ambiguous;
+} Hunt;
 
-static void masks_init(Masks* m, const Board* b){
-    for(int i=0;i<N;i++){ m->row[i]=m->col[i]=m->box[i]=0; }
-    for(int i=0;i<N;i++){
-        for(int j=0;j<N;j++){
-            int v=b->grid[i][j];
-            if(v){
-                unsigned bit=1u<<(v-1);
-                m->row[i]|=bit; m->col[j]|=bit; m->box[box_index(i,j)]|=bit;
+// The engine's cost on 'cell', or -1 without exactly one solution.
+// 'sol' gets the solution.
+static double hunt_cost(const Hunt* h, const uint8_t cell[N*N], uint8_t sol[N*N]){
+    Board b;
+    board_from_cells(&b,cell);
+    if(!is_legal(&b)) return -1;
+    SolverStats st={0};
+    if(count_solutions_ex(&b,2,NULL,&st)!=1) return -1;
+    double cost = h->engine==HUNT_COUNT ? (double)st.nodes : 0;
+    Board s=b;
+    if(h->engine!=HUNT_COUNT || h->timed){
+        Search se={0};
+        double best=-1;
+        for(int rep=0; rep<(h->timed ? 3 : 1); rep++){
+            s=b;
+            uint64_t t0=lat_now();
+            switch(h->engine){
+                case HUNT_SOLVE: search_solve(&s,&se); break;
+                case HUNT_COUNT: count_solutions_ex(&s,2,NULL,NULL); break;
+                case HUNT_LANES: {
+                    bool ok;
+                    BatchStats bs={0};
+                    solve_batch(&s,&ok,1,8,&bs);
+                    break;
+                }
             }
+            double ns=(double)(lat_now()-t0);
+            if(best<0 || ns<best) best=ns;
         }
+        cost = h->timed ? best : (double)se.nodes;
     }
+    if(h->engine==HUNT_COUNT) solve_board(&s);
+    board_to_cells(&s,sol);
+    return cost>1 ? cost : 1;
 }
 
-static inline unsigned used_mask(const Masks* m, int r, int c){
-    return m->row[r] | m->col[c] | m->box[box_index(r,c)];
+static void hunt_sift(HuntEntry* e, int n, int i){
+    for(;;){
+        int m=i, l=2*i+1, r=l+1;
+        if(l<n && e[l].cost<e[m].cost) m=l;
+        if(r<n && e[r].cost<e[m].cost) m=r;
+        if(m==i) return;
+        HuntEntry t=e[i]; e[i]=e[m]; e[m]=t;
+        i=m;
+    }
 }
 
-static inline unsigned candidates_mask(const Masks* m, int r, int c){
-    return (~used_mask(m,r,c)) & ALL;
+// Offers a puzzle to the corpus: it replaces the cheapest entry when it
+// costs more, or an entry of its own class when it beats it.
+static void hunt_offer(Hunt* h, const uint8_t cell[N*N], double cost, CanonWork* cw){
+    pthread_mutex_lock(&h->lock);
+    bool room = h->kept<h->keep || cost>h->best[0].cost;
+    pthread_mutex_unlock(&h->lock);
+    if(!room) return;
+    HuntEntry e={ .cost=cost };
+    Board b;
+    memcpy(e.cell,cell,N*N);
+    board_from_cells(&b,cell);
+    if(!canon_form(&b,&e.canon,cw,NULL)) return;
+    pthread_mutex_lock(&h->lock);
+    int i=0;
+    while(i<h->kept && memcmp(&h->best[i].canon,&e.canon,sizeof e.canon)!=0) i++;
+    if(i<h->kept){
+        if(cost>h->best[i].cost){ h->best[i]=e; hunt_sift(h->best,h->kept,i); }
+    } else if(h->kept<h->keep){
+        h->best[h->kept++]=e;
+        for(int j=h->kept/2-1;j>=0;j--) hunt_sift(h->best,h->kept,j);
+    } else if(cost>h->best[0].cost){
+        h->best[0]=e;
+        hunt_sift(h->best,h->kept,0);
+    }
+    pthread_mutex_unlock(&h->lock);
 }
 
-static void apply_set(Board* b, Masks* m, int r, int c, int v){
-    b->grid[r][c]=v;
-    unsigned bit = 1u<<(v-1);
-    m->row[r] |= bit; m->col[c] |= bit; m->box[box_index(r,c)] |= bit;
+// One annealing chain from puzzle 'start'.
+static void hunt_chain(Hunt* h, int chain, CanonWork* cw){
+    Rng rng={ h->seed + 0x9E3779B97F4A7C15ull*(uint64_t)(chain+1) };
+    uint8_t cur[N*N], sol[N*N], next[N*N], nsol[N*N];
+    memcpy(cur,h->start[(size_t)chain%h->nstart],N*N);
+    double cost=hunt_cost(h,cur,sol);
+    if(cost<0) return;
+    pthread_mutex_lock(&h->lock);
+    if(cost>h->seed_max) h->seed_max=cost;
+    pthread_mutex_unlock(&h->lock);
+    hunt_offer(h,cur,cost,cw);
+    unsigned long long tried=0, accepted=0, ambiguous=0;
+    for(long it=0; it<h->iters; it++){
+        double temp=0.3*(1.0-(double)it/(double)h->iters);
+        int given[N*N], empty[N*N], ng=0, ne=0;
+        for(int i=0;i<N*N;i++){
+            if(cur[i]) given[ng++]=i;
+            else empty[ne++]=i;
+        }
+        memcpy(next,cur,N*N);
+        int g = ng ? given[rng_next(&rng)%(uint64_t)ng] : -1;
+        int e = ne ? empty[rng_next(&rng)%(uint64_t)ne] : -1;
+        switch(rng_next(&rng)%8){
+            case 0: case 1: case 2:                              // move a given
+                if(g<0 || e<0) continue;
+                next[g]=0; next[e]=sol[e];
+                break;
+            case 3: case 4:                                      // drop one
+                if(g<0) continue;
+                next[g]=0;
+                break;
+            case 5:                                              // add one back
+                if(e<0) continue;
+                next[e]=sol[e];
+                break;
+            default:                                             // another digit
+                if(g<0) continue;
+                next[g]=(uint8_t)(1+(next[g]+rng_next(&rng)%(N-1))%N);
+                break;
+        }
+        tried++;
+        double c=hunt_cost(h,next,nsol);
+        if(c<0){ ambiguous++; continue; }
+        hunt_offer(h,next,c,cw);
+        if(c>=cost*(1.0-temp)){
+            memcpy(cur,next,N*N);
+            memcpy(sol,nsol,N*N);
+            cost=c;
+            accepted++;
+        }
+    }
+    atomic_fetch_add(&h->tried,tried);
+    atomic_fetch_add(&h->accepted,accepted);
+    atomic_fetch_add(&h->ambiguous,ambiguous);
 }
 
-static void apply_clear(Board* b, Masks* m, int r, int c){
-    int v=b->grid[r][c];
-    if(!v) return;
-    unsigned bit=1u<<(v-1);
-    m->row[r] &= ~bit; m->col[c] &= ~bit; m->box[box_index(r,c)] &= ~bit;
-    b->grid[r][c]=0;
+static void* hunt_worker(void* arg){
+    Hunt* h=arg;
+    CanonWork cw={0};
+    trace_name("hunter");
+    for(int c; (c=atomic_fetch_add(&h->next_chain,1))<h->chains; ){
+        TRACE_SCOPE("chain");
+        hunt_chain(h,c,&cw);
+    }
+    canon_work_free(&cw);
+    return NULL;
 }
 
-static void copy_board(Board* dst, const Board* src){
-    memcpy(dst, src, sizeof(Board));
+static int hunt_cmp(const void* a, const void* b){
+    double x=((const HuntEntry*)a)->cost, y=((const HuntEntry*)b)->cost;
+    return (x<y)-(x>y);
 }
 
-static void print_board(const Board* b){
-    printf("    1 2 3   4 5 6   7 8 9\n");
-    printf("  +-------+-------+-------+\n");
-    for(int r=0;r<N;r++){
-        printf("%d |", r+1);
-        for(int c=0;c<N;c++){
-            int v=b->grid[r][c];
-            if(v) printf(" %d", v);
-            else  printf(" .");
-            if((c+1)%3==0) printf(" |");
+// sudoku hunt [-e solve|count|lanes] [-m nodes|time] [-i ITERS] [-c CHAINS]
+//             [-k KEEP] [-j N] [-s SEED] [FILE]
+// Writes the KEEP (default 100) hardest puzzles found for the engine, the
+// hardest first, as grid lines: a corpus for bench. Engines: 'solve' is
+// solve_board, 'count' the uniqueness proof (count_solutions_ex to 2),
+// 'lanes' the batch solver; cost is search nodes, or with -m time the best
+// of three runs in ns ('lanes' is always timed). CHAINS (default 16)
+// chains of ITERS (default 2000) steps run on N threads (default: all
+// CPUs), starting from the unique puzzles in FILE, or from generated hard
+// ones without a FILE.
+static int mode_hunt(int argc, char** argv){
+    Hunt h={ .engine=HUNT_SOLVE, .iters=2000, .chains=16, .keep=100, .seed=(uint64_t)time(NULL) };
+    int threads=default_threads();
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-e")==0 && i+1<argc){
+            const char* e=argv[++i];
+            int k=0;
+            while(k<=HUNT_LANES && strcmp(e,hunt_engine_name[k])!=0) k++;
+            if(k>HUNT_LANES){ fputs("engine must be solve, count or lanes\n",stderr); return 2; }
+            h.engine=(HuntEngine)k;
+        }
+        else if(strcmp(argv[i],"-m")==0 && i+1<argc){
+            const char* m=argv[++i];
+            if(strcmp(m,"nodes")!=0 && strcmp(m,"time")!=0){
+                fputs("cost must be nodes or time\n",stderr);
+                return 2;
+            }
+            h.timed = strcmp(m,"time")==0;
         }
-        printf("\n");
-        if((r+1)%3==0) printf("  +-------+-------+-------+\n");
+        else if(strcmp(argv[i],"-i")==0 && i+1<argc) h.iters=atol(argv[++i]);
+        else if(strcmp(argv[i],"-c")==0 && i+1<argc) h.chains=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-k")==0 && i+1<argc) h.keep=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-j")==0 && i+1<argc) threads=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-s")==0 && i+1<argc) h.seed=strtoull(argv[++i],NULL,10);
+        else path=argv[i];
     }
-}
+    if(h.engine==HUNT_LANES) h.timed=true;
+    if(h.iters<1) h.iters=1;
+    if(h.chains<1) h.chains=1;
+    if(h.keep<1) h.keep=1;
+    if(threads<1) threads=1;
+    if(threads>64) threads=64;
 
-static bool is_legal(const Board* b){
-    // rows
-    for(int r=0;r<N;r++){
-        int used=0;
-        for(int c=0;c<N;c++){
-            int v=b->grid[r][c];
-            if(!v) continue;
-            int bit=1<<(v-1);
-            if(used & bit) return false;
-            used |= bit;
+    uint8_t (*start)[N*N]=NULL;
+    size_t n=0, cap=0;
+    if(path){
+        FILE* in=open_input(path);
+        if(!in) return 1;
+        RecordReader rd;
+        Record rec;
+        if(!reader_open(&rd,in)){ fputs("Out of memory.\n",stderr); if(in!=stdin) fclose(in); return 1; }
+        while(reader_line(&rd,&rec) && n<(size_t)h.chains){
+            uint8_t sol[N*N];
+            if(n==cap){
+                cap = cap ? 2*cap : 64;
+                void* p=realloc(start,cap*sizeof *start);
+                if(!p) break;
+                start=p;
+            }
+            if(record_cells(&rec,start[n]) && hunt_cost(&h,start[n],sol)>=0) n++;
         }
+        reader_close(&rd);
+        if(in!=stdin) fclose(in);
+    } else {
+        sudoku_ctx* ctx=sudoku_new(h.seed);
+        if(ctx && (start=malloc((size_t)h.chains*sizeof *start)))
+            for(n=0; n<(size_t)h.chains; n++) sudoku_generate(ctx,SUDOKU_HARD,start[n],NULL);
+        sudoku_free(ctx);
     }
-    // cols
-    for(int c=0;c<N;c++){
-        int used=0;
-        for(int r=0;r<N;r++){
-            int v=b->grid[r][c];
-            if(!v) continue;
-            int bit=1<<(v-1);
-            if(used & bit) return false;
-            used |= bit;
-        }
+    h.best=malloc((size_t)h.keep*sizeof *h.best);
+    if(!n || !h.best){
+        fputs(n ? "Out of memory.\n" : "No unique puzzles to start from.\n",stderr);
+        free(start); free(h.best);
+        return 1;
+    }
+    h.start=(const uint8_t (*)[N*N])start;
+    h.nstart=n;
+    pthread_mutex_init(&h.lock,NULL);
+    atomic_init(&h.next_chain,0);
+
+    double t0=now_seconds();
+    pthread_t tid[64];
+    int started=0;
+    for(int i=1;i<threads && i<h.chains;i++)
+        if(pthread_create(&tid[started],NULL,hunt_worker,&h)==0) started++;
+    hunt_worker(&h);
+    for(int i=0;i<started;i++) pthread_join(tid[i],NULL);
+    double dt=now_seconds()-t0;
+
+    qsort(h.best,(size_t)h.kept,sizeof *h.best,hunt_cmp);
+    Writer w;
+    if(!writer_open(&w,stdout)){ fputs("Out of memory.\n",stderr); free(start); free(h.best); return 1; }
+    for(int i=0;i<h.kept;i++){
+        char* line=writer_space(&w,N*N+1);
+        cells_to_line(h.best[i].cell,line);
+        line[N*N]='\n';
+    }
+    writer_close(&w);
+    const char* unit = h.timed ? "ns" : "nodes";
+    fprintf(stderr,"%s: %llu neighbours tried, %llu accepted, %llu not unique (%.1f s, %d thread%s)\n",
+            hunt_engine_name[h.engine], (unsigned long long)h.tried, (unsigned long long)h.accepted,
+            (unsigned long long)h.ambiguous, dt, started+1, started ? "s" : "");
+    if(h.kept)
+        fprintf(stderr,"kept %d: cost %.0f to %.0f %s, median %.0f (hardest seed %.0f)\n", h.kept,
+                h.best[h.kept-1].cost, h.best[0].cost, unit, h.best[h.kept/2].cost, h.seed_max);
+    pthread_mutex_destroy(&h.lock);
+    free(start); free(h.best);
+    return 0;
+}
+
+/* ------------------------- Patterned puzzles ------------------------- */
+
+// sudoku pattern: for each input line, puzzles with givens on exactly its
+// nonzero cells. Few grids fit most sparse patterns and the search for one
+// is a random walk, so every thread walks from its own seed on the same
+// pattern; the first to find a puzzle raises the flag the others poll.
+typedef struct {
+    const uint8_t* mask;
+    sudoku_budget budget;            // 'cancel' is 'done'
+    int done;                        // the library reads it with __atomic_load_n
+    atomic_int winner;               // -1 until a thread answers
+    int rc;
+    uint8_t puzzle[N*N];
+} PatternRace;
+
+typedef struct { PatternRace* race; sudoku_ctx* ctx; int index; } PatternRacer;
+
+static void* pattern_racer(void* arg){
+    PatternRacer* r=arg;
+    PatternRace* race=r->race;
+    TRACE_SCOPE("pattern");
+    uint8_t puz[N*N];
+    int rc=sudoku_generate_pattern(r->ctx,race->mask,&race->budget,puz,NULL);
+    int none=-1;
+    if(rc!=SUDOKU_GAVE_UP && atomic_compare_exchange_strong(&race->winner,&none,r->index)){
+        race->rc=rc;
+        memcpy(race->puzzle,puz,sizeof puz);
+        __atomic_store_n(&race->done,1,__ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// One puzzle on 'mask' raced over 'threads' contexts within 'ms' (0: no
+// limit): as sudoku_generate_pattern.
+static int pattern_race(sudoku_ctx** ctx, int threads, const uint8_t mask[N*N], long ms, uint8_t puzzle[N*N]){
+    PatternRace race={ .mask=mask, .budget={ .time_ns=(uint64_t)ms*1000000u } };
+    atomic_init(&race.winner,-1);
+    race.budget.cancel=&race.done;
+    PatternRacer racer[64];
+    pthread_t tid[64];
+    int started=0;
+    for(int i=0;i<threads;i++) racer[i]=(PatternRacer){ &race, ctx[i], i };
+    for(int i=1;i<threads;i++)
+        if(pthread_create(&tid[started],NULL,pattern_racer,&racer[i])==0) started++;
+    pattern_racer(&racer[0]);
+    for(int i=0;i<started;i++) pthread_join(tid[i],NULL);
+    if(atomic_load(&race.winner)<0) return SUDOKU_GAVE_UP;
+    memcpy(puzzle,race.puzzle,N*N);
+    return race.rc;
+}
+
+static int mode_pattern(int argc, char** argv){
+    int threads=default_threads(), count=1;
+    long ms=10000;
+    uint64_t seed=(uint64_t)time(NULL);
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-n")==0 && i+1<argc) count=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-t")==0 && i+1<argc) ms=atol(argv[++i]);
+        else if(strcmp(argv[i],"-j")==0 && i+1<argc) threads=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-s")==0 && i+1<argc) seed=strtoull(argv[++i],NULL,10);
+        else path=argv[i];
     }
-    // boxes
-    for(int br=0;br<N;br+=3){
-        for(int bc=0;bc<N;bc+=3){
-            int used=0;
-            for(int dr=0;dr<3;dr++) for(int dc=0;dc<3;dc++){
-                int v=b->grid[br+dr][bc+dc];
-                if(!v) continue;
-                int bit=1<<(v-1);
-                if(used & bit) return false;
-                used |= bit;
+    if(threads<1) threads=1;
+    if(threads>64) threads=64;
+    if(ms<0) ms=0;
+
+    FILE* in=open_input(path);
+    if(!in) return 1;
+    RecordReader rd;
+    sudoku_ctx* ctx[64]={0};
+    bool ok=reader_open(&rd,in);
+    for(int i=0;i<threads && ok;i++) ok = (ctx[i]=sudoku_new(seed+(uint64_t)i))!=NULL;
+    if(!ok){
+        fputs("Out of memory.\n",stderr);
+        for(int i=0;i<threads;i++) sudoku_free(ctx[i]);
+        if(in!=stdin) fclose(in);
+        return 1;
+    }
+    long patterns=0, made=0, impossible=0, timed_out=0;
+    double t0=now_seconds();
+    Record rec;
+    while(reader_line(&rd,&rec)){
+        uint8_t mask[N*N], puz[N*N];
+        if(!record_cells(&rec,mask)){
+            fprintf(stderr,"line %ld: expected 81 cells of 1-9, 0 or '.'\n", rec.line);
+            continue;
+        }
+        patterns++;
+        for(int k=0;k<count;k++){
+            int rc=pattern_race(ctx,threads,mask,ms,puz);
+            if(rc<=0){
+                if(rc==0){
+                    fprintf(stderr,"line %ld: no unique puzzle has this pattern\n", rec.line);
+                    impossible++;
+                } else {
+                    fprintf(stderr,"line %ld: none found in %ld ms\n", rec.line, ms);
+                    timed_out++;
+                }
+                break;
             }
+            char line[N*N+1];
+            cells_to_line(puz,line);
+            line[N*N]='\n';
+            fwrite(line,1,sizeof line,stdout);
+            fflush(stdout);
+            made++;
         }
     }
-    return true;
+    fprintf(stderr,"%ld puzzles from %ld patterns, %ld impossible, %ld timed out (%.1f s, %d thread%s)\n",
+            made, patterns, impossible, timed_out, now_seconds()-t0, threads, threads>1 ? "s" : "");
+    for(int i=0;i<threads;i++) sudoku_free(ctx[i]);
+    reader_close(&rd);
+    if(in!=stdin) fclose(in);
+    return impossible || timed_out;
 }
 
-typedef struct { int r,c; unsigned cand; } Choice;
+/* ------------------------- Benchmark ------------------------- */
 
-static bool find_best_cell(const Board* b, const Masks* m, Choice* ch){
-    unsigned bestMask=0; int bestR=-1, bestC=-1; int bestCount=10;
-    for(int r=0;r<N;r++){
-        for(int c=0;c<N;c++){
-            if(b->grid[r][c]) continue;
-            unsigned cand=candidates_mask(m,r,c);
-            int cnt=popcount9(cand);
-            if(cnt==0) return false; // dead
-            if(cnt<bestCount){
-                bestCount=cnt; bestMask=cand; bestR=r; bestC=c;
-                if(cnt==1) goto done; // MRV shortcut
+// Hardware counters for bench phases through perf_event_open, counting
+// this thread in user space. Each counter is opened on its own, so one the
+// CPU or kernel refuses (LLC events in many VMs, or all of them under a
+// strict perf_event_paranoid) is just left out of the report. Counts are
+// scaled up when the kernel had to multiplex counters.
+enum { PMU_CYCLES, PMU_INSNS, PMU_BRANCH_MISSES, PMU_L1D_MISSES, PMU_LLC_MISSES, PMU_COUNT };
+
+typedef struct {
+    int fd[PMU_COUNT];               // -1: not available
+    double value[PMU_COUNT];         // of the last phase
+} Pmu;
+
+static const char* const pmu_name[PMU_COUNT] = { "cycles", "insns", "br-miss", "L1d-miss", "LLC-miss" };
+
+// False if no counter could be opened; 'why' then says why the first failed.
+static bool pmu_open(Pmu* p, const char** why){
+    int n=0;
+    *why="perf_event_open needs Linux";
+    for(int i=0;i<PMU_COUNT;i++){
+        p->fd[i]=-1;
+#ifdef __linux__
+        static const struct { uint32_t type; uint64_t config; } ev[PMU_COUNT] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ<<8
+                                  | PERF_COUNT_HW_CACHE_RESULT_MISS<<16 },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        };
+        struct perf_event_attr a={ .size=sizeof a, .type=ev[i].type, .config=ev[i].config,
+                                   .disabled=1, .exclude_kernel=1, .exclude_hv=1,
+                                   .read_format=PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING };
+        p->fd[i]=(int)syscall(SYS_perf_event_open,&a,0,-1,-1,0);
+        if(p->fd[i]>=0) n++;
+        else if(!n) *why=strerror(errno);
+#endif
+    }
+    return n>0;
+}
+
+static void pmu_start(Pmu* p){
+#ifdef __linux__
+    for(int i=0;i<PMU_COUNT;i++)
+        if(p->fd[i]>=0){ ioctl(p->fd[i],PERF_EVENT_IOC_RESET,0); ioctl(p->fd[i],PERF_EVENT_IOC_ENABLE,0); }
+#else
+    (void)p;
+#endif
+}
+
+static void pmu_stop(Pmu* p){
+    for(int i=0;i<PMU_COUNT;i++){
+        p->value[i]=-1;
+#ifdef __linux__
+        uint64_t r[3];                   // value, time enabled, time running
+        if(p->fd[i]<0) continue;
+        ioctl(p->fd[i],PERF_EVENT_IOC_DISABLE,0);
+        if(read(p->fd[i],r,sizeof r)==(ssize_t)sizeof r && r[2])
+            p->value[i]=(double)r[0]*((double)r[1]/(double)r[2]);
+#endif
+    }
+}
+
+static void pmu_close(Pmu* p){
+    for(int i=0;i<PMU_COUNT;i++) if(p->fd[i]>=0) close(p->fd[i]);
+}
+
+// One row: each counter divided by 'per', and IPC.
+static void pmu_print(const char* name, const Pmu* p, double per){
+    if(!name){
+        fprintf(stderr,"%-9s %10s", "perf", "per");
+        for(int i=0;i<PMU_COUNT;i++) fprintf(stderr," %9s", pmu_name[i]);
+        fprintf(stderr," %6s\n", "IPC");
+        return;
+    }
+    fprintf(stderr,"%-9s %10.0f", name, per);
+    for(int i=0;i<PMU_COUNT;i++){
+        if(p->value[i]<0 || per<=0) fprintf(stderr," %9s", "-");
+        else fprintf(stderr," %9.1f", p->value[i]/per);
+    }
+    if(p->value[PMU_CYCLES]>0 && p->value[PMU_INSNS]>=0)
+        fprintf(stderr," %6.2f\n", p->value[PMU_INSNS]/p->value[PMU_CYCLES]);
+    else fputs("      -\n",stderr);
+}
+
+// sudoku bench [-g COUNT] [-s SEED] [-p] [-S plain|restarts|lcv] [FILE]
+// Times the library calls on one thread: sudoku_solve and a uniqueness
+// count (limit 2) for every grid in FILE, then COUNT puzzles (default 100)
+// generated at each level. Prints a latency table of the four timed
+// operations; the seed (default 1) makes runs repeatable. -p also reads
+// hardware counters around each phase and prints them per call, and for
+// the count phase per search node. -S picks how sudoku_solve searches
+// (sudoku_set_search): plain (default), randomized restarts, or least
+// constraining digit first.
+static int mode_bench(int argc, char** argv){
+    long count=100;
+    uint64_t seed=1;
+    bool perf=false;
+    sudoku_search search=SUDOKU_SEARCH_PLAIN;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-g")==0 && i+1<argc) count=atol(argv[++i]);
+        else if(strcmp(argv[i],"-s")==0 && i+1<argc) seed=strtoull(argv[++i],NULL,10);
+        else if(strcmp(argv[i],"-p")==0) perf=true;
+        else if(strcmp(argv[i],"-S")==0 && i+1<argc){
+            const char* m=argv[++i];
+            if(strcmp(m,"plain")==0) search=SUDOKU_SEARCH_PLAIN;
+            else if(strcmp(m,"restarts")==0) search=SUDOKU_SEARCH_RESTARTS;
+            else if(strcmp(m,"lcv")==0) search=SUDOKU_SEARCH_LCV;
+            else { fputs("search must be plain, restarts or lcv\n",stderr); return 2; }
+        }
+        else path=argv[i];
+    }
+    if(count<0) count=0;
+    sudoku_ctx* ctx=sudoku_new(seed);
+    if(!ctx){ fputs("Out of memory.\n",stderr); return 1; }
+    sudoku_set_search(ctx,search);
+    Pmu pmu, phase[3];
+    const char* why;
+    if(perf && !pmu_open(&pmu,&why)){
+        fprintf(stderr,"perf counters unavailable (%s); timing only\n", why);
+        perf=false;
+    }
+
+    // the grids are parsed up front so that reading stays out of the counters
+    uint8_t (*grid)[N*N]=NULL;
+    size_t grids=0, cap=0;
+    if(path){
+        FILE* in=open_input(path);
+        RecordReader rd;
+        Record rec;
+        if(!in || !reader_open(&rd,in)){
+            if(in){ fputs("Out of memory.\n",stderr); if(in!=stdin) fclose(in); }
+            if(perf) pmu_close(&pmu);
+            sudoku_free(ctx);
+            return 1;
+        }
+        while(reader_line(&rd,&rec)){
+            if(grids==cap){
+                cap = cap ? 2*cap : 4096;
+                void* g=realloc(grid,cap*sizeof *grid);
+                if(!g) break;
+                grid=g;
             }
+            if(record_cells(&rec,grid[grids])) grids++;
         }
+        reader_close(&rd);
+        if(in!=stdin) fclose(in);
     }
-done:
-    if(bestR==-1) return false;
-    ch->r=bestR; ch->c=bestC; ch->cand=bestMask;
-    return true;
+
+    unsigned long long unsolved=0;
+    SolverStats st={0};
+    double t0=now_seconds();
+    if(perf) pmu_start(&pmu);
+    for(size_t i=0;i<grids;i++){
+        uint8_t out[N*N];
+        if(sudoku_solve(ctx,grid[i],out)!=1) unsolved++;
+    }
+    if(perf){ pmu_stop(&pmu); phase[0]=pmu; pmu_start(&pmu); }
+    double t1=now_seconds();
+    for(size_t i=0;i<grids;i++){
+        // sudoku_count(ctx,grid,2) with the node count kept
+        Board b;
+        board_from_cells(&b,grid[i]);
+        uint64_t c0=lat_now();
+        if(is_legal(&b)) count_solutions_ex(&b,2,NULL,&st);
+        lat_record(&ctx->lat[SUDOKU_OP_COUNT],lat_now()-c0);
+    }
+    if(perf){ pmu_stop(&pmu); phase[1]=pmu; pmu_start(&pmu); }
+    double t2=now_seconds();
+    for(int level=SUDOKU_EASY; level<=SUDOKU_HARD; level++)
+        for(long i=0;i<count;i++){
+            uint8_t puz[N*N];
+            sudoku_generate(ctx,(sudoku_level)level,puz,NULL);
+        }
+    if(perf){ pmu_stop(&pmu); phase[2]=pmu; pmu_close(&pmu); }
+    double t3=now_seconds();
+
+    fprintf(stderr,"%zu grids (%llu unsolvable): solve %.3f s%s, count %.3f s (%llu nodes); "
+            "%ld puzzles per level: %.3f s\n", grids, unsolved, t1-t0, search==SUDOKU_SEARCH_RESTARTS ? " with restarts" : search==SUDOKU_SEARCH_LCV ? " lcv" : "",
+            t2-t1, st.nodes, count, t3-t2);
+    lat_print(NULL,NULL);
+    for(int op=0;op<SUDOKU_OPS;op++) lat_print(op_name[op],&ctx->lat[op]);
+    if(perf){
+        pmu_print(NULL,NULL,0);
+        pmu_print("solve",&phase[0],(double)grids);
+        pmu_print("count",&phase[1],(double)grids);
+        pmu_print("node",&phase[1],(double)st.nodes);
+        pmu_print("generate",&phase[2],3.0*(double)count);
+    }
+    free(grid);
+    sudoku_free(ctx);
+    return 0;
 }
 
-/* ---------- Solver helpers at file scope (no nested functions) ---------- */
+/* ------------------------- Solver daemon ------------------------- */
+#ifdef __linux__
 
-// Count solutions up to 'lim' using MRV backtracking.
-static int count_rec(Board* bb, Masks* mm, int lim){
-    // find next cell
-    bool any_empty=false;
-    for(int r=0;r<N && !any_empty;r++)
-        for(int c=0;c<N;c++)
-            if(!bb->grid[r][c]) { any_empty=true; break; }
-    if(!any_empty) return 1;
+// sudoku serve: one thread owns every socket in an epoll loop and splits
+// the input into request lines; solver work (see serve_heavy) goes to a
+// pool of workers, each with its own sudoku_ctx, and come back through an
+// eventfd. Replies leave in request order on each connection. A connection
+// with SERVE_DEPTH requests in flight is not read until some complete.
+#define SERVE_LINE 256           // longest request, '\n' included
+#define SERVE_INBUF 16384
+#define SERVE_DEPTH 64
+#define SERVE_REPLY (2*N*N+16)
 
-    Choice ch;
-    if(!find_best_cell(bb,mm,&ch)) return 0;
+// Game sessions: the interactive game's state, hosted by the server for any
+// number of clients and addressed by ID. A session is puzzle, solution and
+// current grid packed two cells per byte, 128 bytes in all, carved from
+// slabs of SESSION_SLAB that are never returned; ended sessions go on a
+// free list. An ID is the slot index with the slot's generation above it,
+// so the ID of an ended session stays dead when its slot is reused.
+#define SESSION_SLAB 1024
+#define SESSION_SLABS 4096           // at most 4M sessions
 
-    int total=0;
-    unsigned cand=ch.cand;
-    while(cand){
-        unsigned bit=cand & -cand; cand ^= bit;
-        int v=lsb_index(bit)+1;
-        apply_set(bb,mm,ch.r,ch.c,v);
-        total += count_rec(bb,mm,lim-total);
-        apply_clear(bb,mm,ch.r,ch.c);
-        if(total>=lim) return total;
-    }
-    return total;
+typedef struct {
+    uint32_t gen;                    // odd while the session is live
+    uint8_t current[BANK_CELLS];     // once ended: index+1 of the next free slot, 0 ends the list
+    uint8_t puzzle[BANK_CELLS];      // nonzero cells are fixed
+    uint8_t solution[BANK_CELLS];
+} Session;
+
+_Static_assert(sizeof(Session)==128, "a session is two cache lines");
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t used;                   // slots handed out so far
+    uint32_t free_head;              // index+1, 0 when the list is empty
+    uint32_t live, peak;
+    Session* slab[SESSION_SLABS];
+} SessionPool;
+
+static inline int nibble_get(const uint8_t* p, int i){
+    return i&1 ? p[i>>1]>>4 : p[i>>1]&15;
 }
 
-static int count_solutions(Board* b, int limit){
-    Masks m; masks_init(&m,b);
-    Board tmp=*b;
-    return count_rec(&tmp,&m,limit);
+static inline void nibble_set(uint8_t* p, int i, int v){
+    p[i>>1] = i&1 ? (uint8_t)((p[i>>1]&15)|v<<4) : (uint8_t)((p[i>>1]&0xF0)|v);
 }
 
-// Solve in-place; returns true if solved.
-static bool solve_rec(Board* bb, Masks* mm){
-    // Are we complete?
-    bool any_empty=false;
-    for(int r=0;r<N && !any_empty;r++)
-        for(int c=0;c<N;c++)
-            if(!bb->grid[r][c]) { any_empty=true; break; }
-    if(!any_empty) return true;
+static void session_pool_free(SessionPool* p){
+    for(uint32_t i=0;i<SESSION_SLABS && p->slab[i];i++) free(p->slab[i]);
+    pthread_mutex_destroy(&p->lock);
+}
 
-    Choice ch;
-    if(!find_best_cell(bb,mm,&ch)) return false;
-    unsigned cand=ch.cand;
-    while(cand){
-        unsigned bit=cand & -cand; cand ^= bit;
-        int v=lsb_index(bit)+1;
-        apply_set(bb,mm,ch.r,ch.c,v);
-        if(solve_rec(bb,mm)) return true;
-        apply_clear(bb,mm,ch.r,ch.c);
+// The live session 'id', or NULL. Call with p->lock held.
+static Session* session_get(SessionPool* p, uint64_t id){
+    uint32_t index=(uint32_t)id, gen=(uint32_t)(id>>32);
+    if(index>=p->used || !(gen&1)) return NULL;
+    Session* s=&p->slab[index/SESSION_SLAB][index%SESSION_SLAB];
+    return s->gen==gen ? s : NULL;
+}
+
+// A new session on 'puzzle'; 0 when the pool is full or out of memory.
+static uint64_t session_open(SessionPool* p, const uint8_t puzzle[N*N], const uint8_t solution[N*N]){
+    pthread_mutex_lock(&p->lock);
+    uint32_t index;
+    if(p->free_head){
+        index=p->free_head-1;
+    } else {
+        index=p->used;
+        if(index==SESSION_SLAB*SESSION_SLABS
+           || (!p->slab[index/SESSION_SLAB] && !(p->slab[index/SESSION_SLAB]=calloc(SESSION_SLAB,sizeof(Session))))){
+            pthread_mutex_unlock(&p->lock);
+            return 0;
+        }
+        p->used++;
     }
+    Session* s=&p->slab[index/SESSION_SLAB][index%SESSION_SLAB];
+    if(p->free_head) memcpy(&p->free_head,s->current,sizeof p->free_head);
+    s->gen++;
+    pack_cells(puzzle,s->puzzle);
+    pack_cells(puzzle,s->current);
+    pack_cells(solution,s->solution);
+    if(++p->live>p->peak) p->peak=p->live;
+    uint64_t id=(uint64_t)s->gen<<32 | index;
+    pthread_mutex_unlock(&p->lock);
+    return id;
+}
+
+static bool session_is_command(const char* cmd, size_t n){
+    static const char* const names[] = { "new", "set", "clear", "check", "restart", "show", "end" };
+    for(size_t i=0;i<sizeof names/sizeof names[0];i++)
+        if(strlen(names[i])==n && memcmp(cmd,names[i],n)==0) return true;
     return false;
 }
 
-static bool solve_board(Board* b){
-    Masks m; masks_init(&m,b);
-    return solve_rec(b,&m);
+// Runs a session command, the game's commands with the session ID first,
+// and writes its reply as serve_reply does. 'ctx' and 'budget' are needed
+// by 'new' only.
+//   new [LEVEL|GRID]      ok ID PUZZLE   (GRID must have a unique solution
+//                         proven within the budget)
+//   set ID ROW COL DIGIT  ok | ok solved
+//   clear ID ROW COL      ok
+//   hint ID ROW COL       ok DIGIT, which is also filled in
+//   check ID              ok solved | ok open | ok conflict row|col|box K
+//   solve ID              ok SOLUTION, which becomes the board | none
+//   restart ID            ok
+//   show ID               ok CURRENT
+//   end ID                ok
+static size_t session_reply(SessionPool* p, sudoku_ctx* ctx, const sudoku_budget* budget,
+                            const char* cmd, size_t n, const char* arg, char* reply){
+    uint8_t cell[N*N], sol[N*N];
+    if(n==3 && memcmp(cmd,"new",3)==0){
+        if(strlen(arg)==N*N && line_to_cells(arg,cell)){
+            int sols=sudoku_count_budget(ctx,cell,2,budget,NULL);
+            if(sols==SUDOKU_GAVE_UP) return (size_t)snprintf(reply,SERVE_REPLY,"err gave up\n");
+            if(sols!=1 || sudoku_solve(ctx,cell,sol)!=1)
+                return (size_t)snprintf(reply,SERVE_REPLY,"err puzzle has no unique solution\n");
+        } else {
+            sudoku_generate(ctx,(sudoku_level)parse_difficulty(*arg ? arg : NULL),cell,sol);
+        }
+        uint64_t id=session_open(p,cell,sol);
+        if(!id) return (size_t)snprintf(reply,SERVE_REPLY,"err too many sessions\n");
+        size_t k=(size_t)snprintf(reply,SERVE_REPLY,"ok %llu ",(unsigned long long)id);
+        cells_to_line(cell,reply+k);
+        reply[k+N*N]='\n';
+        return k+N*N+1;
+    }
+
+    char* end;
+    uint64_t id=strtoull(arg,&end,10);
+    int a[3]={0};
+    int want = n==3 && memcmp(cmd,"set",3)==0 ? 3
+             : (n==5 && memcmp(cmd,"clear",5)==0) || (n==4 && memcmp(cmd,"hint",4)==0) ? 2 : 0;
+    if(end==arg || (want && !parse_ints(end,a,want)))
+        return (size_t)snprintf(reply,SERVE_REPLY,"err usage: %.*s ID%s\n", (int)n, cmd,
+                                want==3 ? " ROW COL DIGIT" : want ? " ROW COL" : "");
+    int r=a[0]-1, c=a[1]-1, v=a[2];
+    if(want && (r<0||r>=N||c<0||c>=N||(want==3 && (v<1||v>N))))
+        return (size_t)snprintf(reply,SERVE_REPLY,"err ROW and COL in 1..9%s\n", want==3 ? ", DIGIT in 1..9" : "");
+    int at=r*N+c;
+
+    size_t len=0;
+    pthread_mutex_lock(&p->lock);
+    Session* s=session_get(p,id);
+    if(!s){
+        len=(size_t)snprintf(reply,SERVE_REPLY,"err no such session\n");
+    } else if(want && nibble_get(s->puzzle,at)){
+        len=(size_t)snprintf(reply,SERVE_REPLY,"err that cell is a given\n");
+    } else if(want==3){
+        unpack_cells(s->current,cell);
+        bool legal=true;
+        for(int i=0;i<N;i++)
+            legal &= cell[r*N+i]!=v && cell[i*N+c]!=v && cell[(r/3*3+i/3)*N+c/3*3+i%3]!=v;
+        if(!legal) len=(size_t)snprintf(reply,SERVE_REPLY,"err illegal move\n");
+        else {
+            nibble_set(s->current,at,v);
+            cell[at]=(uint8_t)v;
+            len=(size_t)snprintf(reply,SERVE_REPLY,sudoku_validate(cell,NULL)==SUDOKU_SOLVED ? "ok solved\n" : "ok\n");
+        }
+    } else if(n==5 && memcmp(cmd,"clear",5)==0){
+        nibble_set(s->current,at,0);
+        len=(size_t)snprintf(reply,SERVE_REPLY,"ok\n");
+    } else if(n==4 && memcmp(cmd,"hint",4)==0){
+        v=nibble_get(s->solution,at);
+        nibble_set(s->current,at,v);
+        len=(size_t)snprintf(reply,SERVE_REPLY,"ok %d\n", v);
+    } else if(n==5 && memcmp(cmd,"check",5)==0){
+        int unit;
+        unpack_cells(s->current,cell);
+        switch(sudoku_validate(cell,&unit)){
+            case SUDOKU_SOLVED: len=(size_t)snprintf(reply,SERVE_REPLY,"ok solved\n"); break;
+            case SUDOKU_OPEN: len=(size_t)snprintf(reply,SERVE_REPLY,"ok open\n"); break;
+            default: len=(size_t)snprintf(reply,SERVE_REPLY,"ok conflict %s %d\n", unit_kind[unit/N], unit%N+1);
+        }
+    } else if(n==5 && memcmp(cmd,"solve",5)==0){
+        // The solution is unique, so the board can be completed exactly
+        // when every filled cell agrees with it; no search needed.
+        unpack_cells(s->current,cell);
+        unpack_cells(s->solution,sol);
+        bool ok=true;
+        for(int i=0;i<N*N;i++) ok &= !cell[i] || cell[i]==sol[i];
+        if(!ok) len=(size_t)snprintf(reply,SERVE_REPLY,"none\n");
+        else {
+            memcpy(s->current,s->solution,BANK_CELLS);
+            memcpy(reply,"ok ",3);
+            cells_to_line(sol,reply+3);
+            reply[3+N*N]='\n';
+            len=4+N*N;
+        }
+    } else if(n==7 && memcmp(cmd,"restart",7)==0){
+        memcpy(s->current,s->puzzle,BANK_CELLS);
+        len=(size_t)snprintf(reply,SERVE_REPLY,"ok\n");
+    } else if(n==4 && memcmp(cmd,"show",4)==0){
+        unpack_cells(s->current,cell);
+        memcpy(reply,"ok ",3);
+        cells_to_line(cell,reply+3);
+        reply[3+N*N]='\n';
+        len=4+N*N;
+    } else {                                             // end
+        s->gen++;
+        memcpy(s->current,&p->free_head,sizeof p->free_head);
+        p->free_head=(uint32_t)id+1;
+        p->live--;
+        len=(size_t)snprintf(reply,SERVE_REPLY,"ok\n");
+    }
+    pthread_mutex_unlock(&p->lock);
+    return len;
+}
+
+typedef struct Conn Conn;
+
+typedef struct Job {
+    struct Job* next;            // worker queue, then the done list
+    struct Job* later;           // next request of the same connection
+    Conn* conn;
+    bool done;
+    size_t len;
+    char req[SERVE_LINE];
+    char reply[SERVE_REPLY];
+} Job;
+
+struct Conn {
+    int fd;
+    bool reading;                // EPOLLIN is armed
+    bool eof;                    // no more requests: close once replies are out
+    bool dead;                   // peer gone: drop replies, free when jobs drain
+    bool woken;                  // on this round's list of connections with replies
+    Conn* next_woken;
+    bool closed;                 // done with, freed after the current epoll batch
+    Conn* next_closed;
+    Job* head;                   // requests not yet answered, in order
+    Job* tail;
+    int pending;
+    size_t in_len;
+    char in[SERVE_INBUF];
+    char* out;
+    size_t out_pos, out_len, out_cap;
+};
+
+typedef struct {
+    int ep, listen_fd, wake_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    Job* queue;                  // waiting for a worker, oldest first
+    Job* queue_tail;
+    Job* done;                   // finished, not yet collected
+    Conn* closed;                // to free once no event of the batch can name them
+    bool stop;
+    unsigned long long requests, connections;
+    SessionPool sessions;
+    Portfolio portfolio;         // solve and hint of a grid
+    sudoku_budget budget;        // of each solve, hint, count and new GRID
+    sudoku_ctx* ctx[64];         // one per worker, read for 'stats'
+    int workers;
+} Server;
+
+typedef struct {
+    Server* s;
+    sudoku_ctx* ctx;
+} ServeWorker;
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig){
+    (void)sig;
+    serve_stop=1;
 }
 
-/* ---------------------- Generator utilities ---------------------- */
+static bool serve_heavy(const char* req){
+    size_t n=strcspn(req," ");
+    const char* arg=req+n+strspn(req+n," ");
+    if((n==5 && memcmp(req,"solve",5)==0) || (n==4 && memcmp(req,"hint",4)==0))
+        return strcspn(arg," ")==N*N;           // on a session they are lookups
+    return (n==5 && memcmp(req,"count",5)==0) || (n==8 && memcmp(req,"generate",8)==0)
+        || (n==3 && memcmp(req,"new",3)==0);
+}
 
-static void base_complete(Board* b){
-    // Standard Latin base pattern: value = (r*3 + r/3 + c) % 9 + 1
-    for(int r=0;r<N;r++)
-        for(int c=0;c<N;c++)
-            b->grid[r][c] = ( (r*3 + r/3 + c) % 9 ) + 1;
+// sudoku_solve_budget through the server's portfolio, timed into ctx's
+// histogram.
+static int serve_solve(Server* s, sudoku_ctx* ctx, const uint8_t cell[N*N], uint8_t out[N*N]){
+    Board b;
+    uint64_t t0=lat_now();
+    Bounds bd=budget_bounds(&s->budget,t0);
+    int rc = board_from_cells(&b,cell) && is_legal(&b) ? portfolio_solve(&s->portfolio,&b,&bd) : 0;
+    lat_record(&ctx->lat[SUDOKU_OP_SOLVE],lat_now()-t0);
+    if(rc==1) board_to_cells(&b,out);
+    return rc;
 }
 
-static void shuffle_array(int *a, int n){
-    for(int i=n-1;i>0;i--){
-        int j = rand()%(i+1);
-        int t=a[i]; a[i]=a[j]; a[j]=t;
+// Answers one request line into 'reply', '\n' included. 'ctx' may be NULL
+// for requests serve_heavy turns down. Session commands go to session_reply.
+//   solve GRID            ok SOLUTION | none
+//   count GRID [LIMIT]    ok N           (LIMIT defaults to 1000)
+// Over the server's budget solve, hint and count answer "err gave up".
+//   generate [LEVEL]      ok PUZZLE SOLUTION
+//   validate GRID         ok solved | ok open | ok conflict row|col|box K
+//   hint GRID             ok ROW COL DIGIT for the most constrained empty cell | none
+//   stats OP              ok CALLS P50 P90 P99 P99.9 P99.99 MAX, microseconds over all
+//                         workers, OP one of solve, count, complete, puzzle
+//   stats portfolio       ok CALLS RACED mrv WINS mrv-desc WINS singles WINS transposed WINS
+static size_t serve_reply(Server* s, sudoku_ctx* ctx, const char* req, char* reply){
+    size_t n=strcspn(req," ");
+    const char* arg=req+n;
+    while(*arg==' ') arg++;
+    if(session_is_command(req,n) || (((n==5 && memcmp(req,"solve",5)==0) || (n==4 && memcmp(req,"hint",4)==0))
+                                     && strcspn(arg," ")!=N*N))
+        return session_reply(&s->sessions,ctx,&s->budget,req,n,arg,reply);
+    if(n==5 && memcmp(req,"stats",5)==0 && strcmp(arg,"portfolio")==0){
+        memcpy(reply,"ok ",3);
+        size_t k=3+portfolio_format(&s->portfolio,reply+3,SERVE_REPLY-4);
+        reply[k]='\n';
+        return k+1;
     }
+    if(n==5 && memcmp(req,"stats",5)==0){
+        int op=0;
+        while(op<SUDOKU_OPS && strcmp(arg,op_name[op])!=0) op++;
+        if(op==SUDOKU_OPS) return (size_t)snprintf(reply,SERVE_REPLY,"err usage: stats solve|count|complete|puzzle|portfolio\n");
+        LatHist h={0};
+        for(int i=0;i<s->workers;i++) lat_merge(&h,&s->ctx[i]->lat[op]);
+        memcpy(reply,"ok ",3);
+        size_t k=3+lat_format(&h,reply+3,SERVE_REPLY-4);
+        reply[k]='\n';
+        return k+1;
+    }
+    uint8_t cell[N*N], out[N*N];
+    if(n==8 && memcmp(req,"generate",8)==0){
+        const char* ms=strchr(arg,' ');
+        sudoku_budget budget={ .time_ns = ms ? strtoull(ms,NULL,10)*1000000ull : 0 };
+        sudoku_generate_best(ctx,(sudoku_level)parse_difficulty(*arg ? arg : NULL),&budget,cell,out);
+        memcpy(reply,"ok ",3);
+        cells_to_line(cell,reply+3);
+        reply[3+N*N]=' ';
+        cells_to_line(out,reply+4+N*N);
+        reply[4+2*N*N]='\n';
+        return 5+2*N*N;
+    }
+    bool grid = strlen(arg)>=N*N && (arg[N*N]==0 || arg[N*N]==' ') && line_to_cells(arg,cell);
+    if(n==5 && memcmp(req,"solve",5)==0 && grid){
+        int rc=serve_solve(s,ctx,cell,out);
+        if(rc==SUDOKU_GAVE_UP) return (size_t)snprintf(reply,SERVE_REPLY,"err gave up\n");
+        if(rc!=1){ memcpy(reply,"none\n",5); return 5; }
+        memcpy(reply,"ok ",3);
+        cells_to_line(out,reply+3);
+        reply[3+N*N]='\n';
+        return 4+N*N;
+    }
+    if(n==5 && memcmp(req,"count",5)==0 && grid){
+        int limit = arg[N*N] ? atoi(arg+N*N) : 1000;
+        sudoku_stats st;
+        int sols=sudoku_count_budget(ctx,cell,limit>0 ? limit : 1000,&s->budget,&st);
+        if(sols==SUDOKU_GAVE_UP)
+            return (size_t)snprintf(reply,SERVE_REPLY,"err gave up after %d solutions\n", st.solutions);
+        return (size_t)snprintf(reply,SERVE_REPLY,"ok %d\n", sols);
+    }
+    if(n==8 && memcmp(req,"validate",8)==0 && grid){
+        int unit;
+        switch(sudoku_validate(cell,&unit)){
+            case SUDOKU_SOLVED: return (size_t)snprintf(reply,SERVE_REPLY,"ok solved\n");
+            case SUDOKU_OPEN: return (size_t)snprintf(reply,SERVE_REPLY,"ok open\n");
+            default: return (size_t)snprintf(reply,SERVE_REPLY,"ok conflict %s %d\n",
+                                             unit_kind[unit/N], unit%N+1);
+        }
+    }
+    if(n==4 && memcmp(req,"hint",4)==0 && grid){
+        Board b;
+        Masks m;
+        Choice ch;
+        board_from_cells(&b,cell);
+        masks_init(&m,&b);
+        int rc=serve_solve(s,ctx,cell,out);
+        if(rc==SUDOKU_GAVE_UP) return (size_t)snprintf(reply,SERVE_REPLY,"err gave up\n");
+        if(rc!=1 || !find_best_cell(&b,&m,&ch)){ memcpy(reply,"none\n",5); return 5; }
+        return (size_t)snprintf(reply,SERVE_REPLY,"ok %d %d %d\n", ch.r+1, ch.c+1, out[ch.r*N+ch.c]);
+    }
+    if(serve_heavy(req) || (n==8 && memcmp(req,"validate",8)==0))
+        return (size_t)snprintf(reply,SERVE_REPLY,"err expected 81 cells of 1-9, 0 or '.'\n");
+    return (size_t)snprintf(reply,SERVE_REPLY,"err unknown command\n");
 }
 
-static void permute_digits(Board* b){
-    int map[10]; for(int i=1;i<=9;i++) map[i]=i;
-    shuffle_array(&map[1],9);
-    for(int r=0;r<N;r++) for(int c=0;c<N;c++){
-        int v=b->grid[r][c];
-        b->grid[r][c]=map[v];
+static void* serve_worker(void* arg){
+    Server* s=((ServeWorker*)arg)->s;
+    sudoku_ctx* ctx=((ServeWorker*)arg)->ctx;
+    trace_name("worker");
+    pthread_mutex_lock(&s->lock);
+    for(;;){
+        while(!s->queue && !s->stop) pthread_cond_wait(&s->more,&s->lock);
+        if(!s->queue) break;
+        Job* j=s->queue;
+        s->queue=j->next;
+        pthread_mutex_unlock(&s->lock);
+        TRACE_SCOPE("request");
+        j->len=serve_reply(s,ctx,j->req,j->reply);
+        pthread_mutex_lock(&s->lock);
+        j->next=s->done;
+        s->done=j;
+        uint64_t one=1;
+        if(write(s->wake_fd,&one,sizeof one)<0) {}      // the counter cannot overflow here
     }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
 }
 
-static void shuffle_rows_within_bands(Board* b){
-    for(int band=0; band<3; band++){
-        int rows[3]={band*3, band*3+1, band*3+2};
-        shuffle_array(rows,3);
-        int tmp[3][N];
-        for(int i=0;i<3;i++) for(int c=0;c<N;c++) tmp[i][c]=b->grid[rows[i]][c];
-        for(int i=0;i<3;i++) for(int c=0;c<N;c++) b->grid[band*3+i][c]=tmp[i][c];
-    }
+static void conn_watch(Server* s, Conn* c){
+    struct epoll_event ev={ .events=(c->reading ? EPOLLIN : 0) | (c->out_len>c->out_pos ? EPOLLOUT : 0),
+                            .data.ptr=c };
+    epoll_ctl(s->ep,EPOLL_CTL_MOD,c->fd,&ev);
+}
+
+static void conn_close(Server* s, Conn* c){
+    if(c->fd<0) return;
+    epoll_ctl(s->ep,EPOLL_CTL_DEL,c->fd,NULL);
+    close(c->fd);
+    c->fd=-1;
+}
+
+// Closes c and queues it for serve_reap: a later event of the same
+// epoll batch may still point at it.
+static void conn_retire(Server* s, Conn* c){
+    conn_close(s,c);
+    c->closed=true;
+    c->next_closed=s->closed;
+    s->closed=c;
 }
 
-static void shuffle_cols_within_stacks(Board* b){
-    for(int stack=0; stack<3; stack++){
-        int cols[3]={stack*3, stack*3+1, stack*3+2};
-        shuffle_array(cols,3);
-        int tmp[3][N];
-        for(int i=0;i<3;i++) for(int r=0;r<N;r++) tmp[i][r]=b->grid[r][cols[i]];
-        for(int i=0;i<3;i++) for(int r=0;r<N;r++) b->grid[r][stack*3+i]=tmp[i][r];
+static void serve_reap(Server* s){
+    while(s->closed){
+        Conn* c=s->closed;
+        s->closed=c->next_closed;
+        free(c->out);
+        free(c);
     }
 }
 
-static void shuffle_bands(Board* b){
-    int bands[3]={0,1,2};
-    shuffle_array(bands,3);
-    Board copy=*b;
-    for(int i=0;i<3;i++){
-        for(int r=0;r<3;r++){
-            for(int c=0;c<N;c++){
-                b->grid[i*3+r][c] = copy.grid[bands[i]*3+r][c];
-            }
+// Turns complete lines in c->in into jobs, up to SERVE_DEPTH in flight.
+static void conn_parse(Server* s, Conn* c){
+    size_t pos=0;
+    while(c->pending<SERVE_DEPTH && !c->eof){
+        char* nl=memchr(c->in+pos,'\n',c->in_len-pos);
+        if(!nl) break;
+        size_t len=(size_t)(nl-(c->in+pos));
+        if(len && c->in[pos+len-1]=='\r') len--;
+        const char* line=c->in+pos;
+        pos=(size_t)(nl-c->in)+1;
+        if(!len) continue;
+        if(len==4 && memcmp(line,"quit",4)==0){ c->eof=true; break; }
+        Job* j=malloc(sizeof *j);
+        if(!j){ c->eof=true; break; }
+        if(len>=SERVE_LINE) len=0;
+        memcpy(j->req,line,len);
+        j->req[len]=0;
+        j->conn=c; j->later=NULL; j->next=NULL; j->done=false;
+        if(c->tail) c->tail->later=j; else c->head=j;
+        c->tail=j;
+        c->pending++;
+        s->requests++;
+        if(!len || !serve_heavy(j->req)){
+            j->len = len ? serve_reply(s,NULL,j->req,j->reply)
+                         : (size_t)snprintf(j->reply,SERVE_REPLY,"err line too long\n");
+            j->done=true;
+            continue;
         }
+        pthread_mutex_lock(&s->lock);
+        if(s->queue) s->queue_tail->next=j; else s->queue=j;
+        s->queue_tail=j;
+        pthread_cond_signal(&s->more);
+        pthread_mutex_unlock(&s->lock);
     }
+    memmove(c->in,c->in+pos,c->in_len-pos);
+    c->in_len-=pos;
 }
 
-static void shuffle_stacks(Board* b){
-    int stacks[3]={0,1,2};
-    shuffle_array(stacks,3);
-    Board copy=*b;
-    for(int i=0;i<3;i++){
-        for(int c=0;c<3;c++){
-            for(int r=0;r<N;r++){
-                b->grid[r][i*3+c] = copy.grid[r][stacks[i]*3+c];
+// Moves finished replies from the front of c's queue to its output and
+// writes what the socket takes. Returns false once c has been retired.
+static bool conn_flush(Server* s, Conn* c){
+    while(c->head && c->head->done){
+        Job* j=c->head;
+        if(!c->dead){
+            if(c->out_cap-c->out_len < j->len){
+                if(c->out_pos){
+                    memmove(c->out,c->out+c->out_pos,c->out_len-c->out_pos);
+                    c->out_len-=c->out_pos; c->out_pos=0;
+                }
+                if(c->out_cap-c->out_len < j->len){
+                    size_t cap = c->out_cap ? 2*c->out_cap : 4096;
+                    char* o=realloc(c->out,cap);
+                    if(!o){ c->dead=true; continue; }
+                    c->out=o; c->out_cap=cap;
+                }
             }
+            memcpy(c->out+c->out_len,j->reply,j->len);
+            c->out_len+=j->len;
+        }
+        c->head=j->later;
+        if(!c->head) c->tail=NULL;
+        c->pending--;
+        free(j);
+    }
+    while(!c->dead && c->out_pos<c->out_len){
+        ssize_t k=send(c->fd,c->out+c->out_pos,c->out_len-c->out_pos,MSG_NOSIGNAL);
+        if(k<0){
+            if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+            if(errno==EINTR) continue;
+            c->dead=true;
+            break;
+        }
+        c->out_pos+=(size_t)k;
+    }
+    if(c->out_pos==c->out_len) c->out_pos=c->out_len=0;
+    if(c->dead || c->eof){
+        c->reading=false;
+        if(!c->head && (c->dead || !c->out_len)){ conn_retire(s,c); return false; }
+        if(c->dead){ conn_close(s,c); return true; }
+    } else {
+        if(c->pending<SERVE_DEPTH && c->in_len){
+            conn_parse(s,c);
+            if(c->head && c->head->done) return conn_flush(s,c);     // answered inline
         }
+        c->reading = c->pending<SERVE_DEPTH;    // paused at depth, resumed by the replies
     }
+    conn_watch(s,c);
+    return true;
 }
 
-typedef enum { DIFF_EASY, DIFF_MEDIUM, DIFF_HARD } Difficulty;
-
-static Difficulty parse_difficulty(const char* s){
-    if(!s) return DIFF_MEDIUM;
-    if(strncmp(s,"easy",4)==0) return DIFF_EASY;
-    if(strncmp(s,"hard",4)==0) return DIFF_HARD;
-    return DIFF_MEDIUM;
+static void conn_read(Server* s, Conn* c){
+    while(c->reading){
+        ssize_t k=read(c->fd,c->in+c->in_len,sizeof c->in-c->in_len);
+        if(k<0){
+            if(errno==EINTR) continue;
+            if(errno!=EAGAIN && errno!=EWOULDBLOCK) c->dead=true;
+            break;
+        }
+        if(k==0){ c->eof=true; break; }
+        c->in_len+=(size_t)k;
+        conn_parse(s,c);
+        if(c->pending>=SERVE_DEPTH || c->eof) break;
+        if(c->in_len==sizeof c->in){ c->dead=true; break; }    // no line end in sight
+    }
+    conn_flush(s,c);
 }
 
-static int target_clues(Difficulty d){
-    switch(d){
-        case DIFF_EASY: return 45;   // easier: more givens
-        case DIFF_MEDIUM: return 36;
-        case DIFF_HARD: return 27;   // harder: fewer givens
-        default: return 36;
+static void serve_accept(Server* s){
+    for(;;){
+        int fd=accept(s->listen_fd,NULL,NULL);
+        if(fd<0) return;
+        Conn* c=calloc(1,sizeof *c);
+        fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+        struct epoll_event ev={ .events=EPOLLIN, .data.ptr=c };
+        if(!c || epoll_ctl(s->ep,EPOLL_CTL_ADD,fd,&ev)!=0){
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd=fd;
+        c->reading=true;
+        s->connections++;
     }
 }
 
-static void generate_complete(Board* sol){
-    base_complete(sol);
-    permute_digits(sol);
-    shuffle_rows_within_bands(sol);
-    shuffle_cols_within_stacks(sol);
-    shuffle_bands(sol);
-    shuffle_stacks(sol);
+// Unix socket at 'path', listening; a stale socket file is replaced.
+static int serve_listen(const char* path){
+    struct sockaddr_un sa={ .sun_family=AF_UNIX };
+    if(strlen(path)>=sizeof sa.sun_path){
+        fprintf(stderr,"%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(sa.sun_path,path);
+    int fd=socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd<0){ perror("socket"); return -1; }
+    if(bind(fd,(struct sockaddr*)&sa,sizeof sa)!=0 && errno==EADDRINUSE){
+        int probe=socket(AF_UNIX,SOCK_STREAM,0);
+        bool live = probe>=0 && connect(probe,(struct sockaddr*)&sa,sizeof sa)==0;
+        if(probe>=0) close(probe);
+        if(live){
+            fprintf(stderr,"%s: a server is already listening\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        if(bind(fd,(struct sockaddr*)&sa,sizeof sa)!=0){ perror(path); close(fd); return -1; }
+    }
+    if(listen(fd,SOMAXCONN)!=0){ perror(path); close(fd); return -1; }
+    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+    return fd;
 }
 
-// Make a puzzle from a complete solution by removing symmetric pairs,
-// ensuring uniqueness via solution counting (up to 2).
-static void make_puzzle(const Board* solution, Board* puzzle, Difficulty d){
-    copy_board(puzzle, solution);
-    int target = target_clues(d);
-    int clues = N*N;
-
-    int cells[N*N];
-    for(int i=0;i<N*N;i++) cells[i]=i;
-    shuffle_array(cells,N*N);
-
-    int attempts = 0;
-    for(int idx=0; idx<N*N && clues>target; idx++){
-        int i=cells[idx];
-        int r=i/9, c=i%9;
-        int sr=8-r, sc=8-c; // symmetric cell
-        if(puzzle->grid[r][c]==0) continue;
+// sudoku serve [-j N] [-P RACERS] [-t MS] [-n NODES] SOCKET
+// Answers line requests (see serve_reply) on the Unix socket SOCKET until
+// SIGINT or SIGTERM, with N solver threads (default: all CPUs). A hard
+// solve races up to RACERS strategies (default: all CPUs, at most 4; 1
+// turns racing off). A solve, hint, count or new GRID that takes over MS
+// milliseconds (default 1000) or NODES search nodes (default: no limit)
+// is answered "err gave up"; 0 lifts either limit.
+static int mode_serve(int argc, char** argv){
+    int threads=default_threads(), racers=default_threads();
+    sudoku_budget budget={ .time_ns=1000000000 };
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-j")==0 && i+1<argc) threads=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-P")==0 && i+1<argc) racers=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-t")==0 && i+1<argc) budget.time_ns=strtoull(argv[++i],NULL,10)*1000000;
+        else if(strcmp(argv[i],"-n")==0 && i+1<argc) budget.max_nodes=strtoull(argv[++i],NULL,10);
+        else path=argv[i];
+    }
+    if(!path){ fputs("serve: missing socket path\n",stderr); return 2; }
+    if(threads<1) threads=1;
+    if(threads>64) threads=64;
+    Server s={ .ep=epoll_create1(0), .listen_fd=serve_listen(path), .wake_fd=eventfd(0,EFD_NONBLOCK), .budget=budget };
+    pthread_mutex_init(&s.lock,NULL);
+    pthread_mutex_init(&s.sessions.lock,NULL);
+    pthread_cond_init(&s.more,NULL);
+    portfolio_init(&s.portfolio,racers);
+    struct epoll_event ev={ .events=EPOLLIN, .data.ptr=&s.listen_fd };
+    struct epoll_event wake={ .events=EPOLLIN, .data.ptr=&s.wake_fd };
+    bool ok = s.ep>=0 && s.listen_fd>=0 && s.wake_fd>=0
+              && epoll_ctl(s.ep,EPOLL_CTL_ADD,s.listen_fd,&ev)==0
+              && epoll_ctl(s.ep,EPOLL_CTL_ADD,s.wake_fd,&wake)==0;
+    pthread_t tid[64];
+    ServeWorker wk[64];
+    int started=0;
+    uint64_t seed=(uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&s;
+    while(ok && s.workers<threads && (s.ctx[s.workers]=sudoku_new(seed+(uint64_t)s.workers))) s.workers++;
+    while(ok && started<s.workers){
+        wk[started]=(ServeWorker){ &s, s.ctx[started] };
+        if(pthread_create(&tid[started],NULL,serve_worker,&wk[started])!=0) break;
+        started++;
+    }
+    if(ok && !started){ fputs("Cannot start threads.\n",stderr); ok=false; }
 
-        // Try removing one or the symmetric pair
-        int removed=0;
-        Board test; copy_board(&test,puzzle);
-        test.grid[r][c]=0; removed++;
-        if(!(sr==r && sc==c) && test.grid[sr][sc]!=0){ test.grid[sr][sc]=0; removed++; }
+    struct sigaction sa={ .sa_handler=serve_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGTERM,&sa,NULL);
+    if(ok) fprintf(stderr,"serving on %s with %d worker%s\n", path, started, started==1?"":"s");
+    double t0=now_seconds();
+    while(ok && !serve_stop){
+        struct epoll_event evs[64];
+        int n=epoll_wait(s.ep,evs,64,-1);
+        for(int i=0;i<n;i++){
+            void* p=evs[i].data.ptr;
+            if(p==&s.listen_fd){ serve_accept(&s); continue; }
+            if(p!=&s.wake_fd){
+                Conn* c=p;
+                if(c->closed) continue;
+                if(evs[i].events & (EPOLLHUP|EPOLLERR)) c->dead=true;
+                if(evs[i].events & EPOLLIN) conn_read(&s,c);
+                else conn_flush(&s,c);
+                continue;
+            }
+            uint64_t cnt;
+            if(read(s.wake_fd,&cnt,sizeof cnt)<0) {}
+            pthread_mutex_lock(&s.lock);
+            Job* done=s.done;
+            s.done=NULL;
+            pthread_mutex_unlock(&s.lock);
+            // collect the connections first: flushing frees jobs, maybe connections
+            Conn* woken=NULL;
+            for(Job* j=done;j;j=j->next){
+                j->done=true;
+                if(!j->conn->woken){ j->conn->woken=true; j->conn->next_woken=woken; woken=j->conn; }
+            }
+            while(woken){
+                Conn* c=woken;
+                woken=c->next_woken;
+                c->woken=false;
+                if(!c->closed) conn_flush(&s,c);
+            }
+        }
+        serve_reap(&s);
+    }
+    double dt=now_seconds()-t0;
 
-        int sols = count_solutions(&test, 2);
-        if(sols==1){
-            puzzle->grid[r][c]=0;
-            if(!(sr==r && sc==c)) puzzle->grid[sr][sc]=0;
-            clues -= removed;
+    pthread_mutex_lock(&s.lock);
+    s.stop=true;
+    s.queue=NULL;                    // connections are dropped below; their jobs with them
+    pthread_cond_broadcast(&s.more);
+    pthread_mutex_unlock(&s.lock);
+    for(int i=0;i<started;i++) pthread_join(tid[i],NULL);
+    if(ok){
+        fprintf(stderr,"%llu requests on %llu connections (%.1f s)\n", s.requests, s.connections, dt);
+        LatHist* h=calloc(SUDOKU_OPS,sizeof *h);
+        uint64_t timed=0;
+        for(int op=0;h && op<SUDOKU_OPS;op++){
+            for(int i=0;i<s.workers;i++) lat_merge(&h[op],&s.ctx[i]->lat[op]);
+            timed+=atomic_load(&h[op].calls);
         }
-        attempts++;
-        if(attempts>20000) break; // safety cap
+        if(timed){
+            lat_print(NULL,NULL);
+            for(int op=0;op<SUDOKU_OPS;op++) lat_print(op_name[op],&h[op]);
+        }
+        free(h);
+        if(atomic_load(&s.portfolio.raced)){
+            char line[256];
+            portfolio_format(&s.portfolio,line,sizeof line);
+            fprintf(stderr,"portfolio (calls raced wins): %s\n", line);
+        }
+        SessionPool* sp=&s.sessions;
+        if(sp->peak)
+            fprintf(stderr,"%u sessions open, %u at peak, %.1f MiB in %u slabs of %d\n", sp->live, sp->peak,
+                    (double)((sp->used+SESSION_SLAB-1)/SESSION_SLAB)*SESSION_SLAB*sizeof(Session)/(1<<20),
+                    (sp->used+SESSION_SLAB-1)/SESSION_SLAB, SESSION_SLAB);
     }
+    if(s.listen_fd>=0){ close(s.listen_fd); unlink(path); }
+    if(s.wake_fd>=0) close(s.wake_fd);
+    if(s.ep>=0) close(s.ep);
+    pthread_cond_destroy(&s.more);
+    pthread_mutex_destroy(&s.lock);
+    session_pool_free(&s.sessions);
+    for(int i=0;i<s.workers;i++) sudoku_free(s.ctx[i]);
+    return ok ? 0 : 1;
 }
 
-/* ------------------------- Game UI ------------------------- */
+// sudoku loadtest [-c CONNS] [-d DEPTH] [-n COUNT] [-r CMD] [-g SESSIONS] SOCKET [FILE]
+// Sends COUNT requests (default 100000) over CONNS connections (default 8),
+// each keeping DEPTH requests in flight (default 1), and reports throughput
+// and latency percentiles. Requests are "CMD GRID" over the grids in FILE
+// (CMD defaults to solve), or "generate medium" without a FILE. With -g it
+// first opens SESSIONS game sessions ("new GRID", or "new medium") and then
+// sends check, show and restart to sessions picked at random.
+typedef struct {
+    int fd;
+    size_t sent_n, got_n;            // requests sent and answered on this connection
+    double* sent_at;                 // DEPTH send times, a ring
+    size_t in_len;
+    char in[SERVE_INBUF];
+} LoadConn;
 
-static void print_help(void){
-    puts("Commands:");
-    puts("  set r c v     - place value v (1..9) at row r, col c (1..9)");
-    puts("  clear r c     - clear cell at (r,c)");
-    puts("  hint r c      - fill the correct value for (r,c)");
-    puts("  check         - verify no rule is violated");
-    puts("  solve         - fill the whole solution");
-    puts("  restart       - revert to the original puzzle");
-    puts("  print         - show the current board");
-    puts("  help          - show this help");
-    puts("  quit          - exit");
+typedef struct {
+    LoadConn* lc;
+    int conns, depth, ep;
+    const char* reqs;                // request lines, SERVE_LINE apart, sent round-robin
+    size_t nreq;
+    uint64_t* ids;                   // sessions opened, once reqs are "new" lines
+    size_t nids;
+    Rng rng;
+} LoadTest;
+
+static int lat_cmp(const void* a, const void* b){
+    double x=*(const double*)a, y=*(const double*)b;
+    return (x>y)-(x<y);
 }
 
-static bool read_line(char* buf, size_t cap){
-    if(!fgets(buf,(int)cap,stdin)) return false;
-    size_t n=strlen(buf);
-    if(n && buf[n-1]=='\n') buf[n-1]=0;
-    return true;
+// Request number i into 'line'; driving sessions once t->ids is complete.
+static const char* load_request(LoadTest* t, unsigned long long i, bool sessions, char* line){
+    if(!sessions) return t->reqs+(i%t->nreq)*SERVE_LINE;
+    static const char* const ops[] = { "check", "show", "restart" };
+    snprintf(line,SERVE_LINE,"%s %llu\n", ops[i%3], (unsigned long long)t->ids[rng_next(&t->rng)%t->nids]);
+    return line;
 }
 
-static bool parse_ints(const char* s, int* a, int need){
-    int count=0;
-    while(*s && count<need){
-        while(*s && isspace((unsigned char)*s)) s++;
-        if(!*s) break;
-        char* end=NULL;
-        long v=strtol(s,&end,10);
-        if(s==end) return false;
-        a[count++]=(int)v;
-        s=end;
+// Runs 'total' requests, latencies into 'lat'. Replies to "new" lines add
+// their session IDs to t->ids. Returns the number answered.
+static unsigned long long load_run(LoadTest* t, unsigned long long total, bool sessions, double* lat,
+                                   unsigned long long* errors){
+    unsigned long long next=0, done=0;
+    char line[SERVE_LINE];
+    bool fail=false;
+    for(int i=0;i<t->conns;i++) t->lc[i].sent_n=t->lc[i].got_n=0;
+    // prime every connection to DEPTH, then send one request per reply
+    for(int i=0;!fail && i<t->conns;i++)
+        for(int d=0; d<t->depth && next<total; d++){
+            const char* req=load_request(t,next++,sessions,line);
+            t->lc[i].sent_at[t->lc[i].sent_n++%(size_t)t->depth]=now_seconds();
+            if(send(t->lc[i].fd,req,strlen(req),MSG_NOSIGNAL)<0){ perror("send"); fail=true; break; }
+        }
+    while(!fail && done<total){
+        struct epoll_event evs[64];
+        int n=epoll_wait(t->ep,evs,64,-1);
+        if(n<0 && errno!=EINTR){ perror("epoll_wait"); break; }
+        for(int i=0;i<n && !fail;i++){
+            LoadConn* c=evs[i].data.ptr;
+            ssize_t k=read(c->fd,c->in+c->in_len,sizeof c->in-c->in_len);
+            if(k<=0){ fputs("loadtest: server closed the connection\n",stderr); fail=true; break; }
+            c->in_len+=(size_t)k;
+            size_t pos=0;
+            char* nl;
+            while((nl=memchr(c->in+pos,'\n',c->in_len-pos))){
+                double now=now_seconds();
+                lat[done++]=now-c->sent_at[c->got_n++%(size_t)t->depth];
+                if(strncmp(c->in+pos,"ok",2)!=0 && strncmp(c->in+pos,"none",4)!=0) (*errors)++;
+                else if(t->ids && !sessions) t->ids[t->nids++]=strtoull(c->in+pos+2,NULL,10);
+                pos=(size_t)(nl-c->in)+1;
+                if(next<total){
+                    const char* req=load_request(t,next++,sessions,line);
+                    c->sent_at[c->sent_n++%(size_t)t->depth]=now;
+                    if(send(c->fd,req,strlen(req),MSG_NOSIGNAL)<0){ perror("send"); fail=true; break; }
+                }
+            }
+            memmove(c->in,c->in+pos,c->in_len-pos);
+            c->in_len-=pos;
+        }
     }
-    return count==need;
+    return done;
 }
 
-static bool can_place(const Board* current, const Board* fixed, int r, int c, int v){
-    if(fixed->grid[r][c]) return false;
-    for(int i=0;i<N;i++){
-        if(current->grid[r][i]==v) return false;
-        if(current->grid[i][c]==v) return false;
-    }
-    int br=(r/3)*3, bc=(c/3)*3;
-    for(int dr=0;dr<3;dr++) for(int dc=0;dc<3;dc++)
-        if(current->grid[br+dr][bc+dc]==v) return false;
-    return true;
+static void load_report(const char* what, double* lat, unsigned long long done, unsigned long long errors,
+                        double dt, const LoadTest* t){
+    if(!done) return;
+    qsort(lat,(size_t)done,sizeof *lat,lat_cmp);
+    #define PCT(p) (lat[(size_t)((double)(done-1)*(p))]*1e6)
+    fprintf(stderr,"%llu %s, %llu errors, %d connection%s x %d deep (%.3f s, %.0f/s)\n"
+            "latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+            done, what, errors, t->conns, t->conns==1?"":"s", t->depth, dt, dt>0 ? (double)done/dt : 0.0,
+            PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), PCT(1.0));
+    #undef PCT
 }
 
-static bool is_complete_and_correct(const Board* current){
-    for(int r=0;r<N;r++) for(int c=0;c<N;c++){
-        int v=current->grid[r][c];
-        if(v<1 || v>9) return false;
-        for(int i=0;i<N;i++){
-            if(i!=c && current->grid[r][i]==v) return false;
-            if(i!=r && current->grid[i][c]==v) return false;
+static int mode_loadtest(int argc, char** argv){
+    LoadTest t={ .conns=8, .depth=1, .rng={ (uint64_t)time(NULL) } };
+    unsigned long long total=100000, sessions=0;
+    const char* cmd="solve";
+    const char* sock=NULL;
+    const char* path=NULL;
+    for(int i=1;i<argc;i++){
+        if(strcmp(argv[i],"-c")==0 && i+1<argc) t.conns=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-d")==0 && i+1<argc) t.depth=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-n")==0 && i+1<argc) total=strtoull(argv[++i],NULL,10);
+        else if(strcmp(argv[i],"-r")==0 && i+1<argc) cmd=argv[++i];
+        else if(strcmp(argv[i],"-g")==0 && i+1<argc) sessions=strtoull(argv[++i],NULL,10);
+        else if(!sock) sock=argv[i];
+        else path=argv[i];
+    }
+    if(!sock){ fputs("loadtest: missing socket path\n",stderr); return 2; }
+    if(t.conns<1) t.conns=1;
+    if(t.depth<1) t.depth=1;
+    if(t.depth>SERVE_DEPTH) t.depth=SERVE_DEPTH;
+    if(sessions) cmd="new";
+
+    char* reqs=NULL;
+    size_t nreq=0, cap=0;
+    if(path){
+        FILE* in=open_input(path);
+        if(!in) return 1;
+        RecordReader rd;
+        Record rec;
+        if(!reader_open(&rd,in)){ fputs("Out of memory.\n",stderr); if(in!=stdin) fclose(in); return 1; }
+        while(reader_line(&rd,&rec)){
+            uint8_t cell[N*N];
+            if(!record_cells(&rec,cell)) continue;
+            if(nreq==cap){
+                cap = cap ? 2*cap : 1024;
+                char* r=realloc(reqs,cap*SERVE_LINE);
+                if(!r){ nreq=0; break; }
+                reqs=r;
+            }
+            char* line=reqs+nreq++*SERVE_LINE;
+            int k=snprintf(line,SERVE_LINE-N*N-1,"%s ",cmd);
+            cells_to_line(cell,line+k);
+            memcpy(line+k+N*N,"\n",2);
         }
-        int br=(r/3)*3, bc=(c/3)*3;
-        for(int dr=0;dr<3;dr++) for(int dc=0;dc<3;dc++){
-            int rr=br+dr, cc=bc+dc;
-            if(rr==r && cc==c) continue;
-            if(current->grid[rr][cc]==v) return false;
+        reader_close(&rd);
+        if(in!=stdin) fclose(in);
+    } else if((reqs=malloc(SERVE_LINE))){
+        strcpy(reqs, sessions ? "new medium\n" : "generate medium\n");
+        nreq=1;
+    }
+    t.reqs=reqs;
+    t.nreq=nreq;
+    unsigned long long most = total>sessions ? total : sessions;
+    double* lat=malloc(most*sizeof *lat);
+    t.lc=calloc((size_t)t.conns,sizeof *t.lc);
+    t.ids = sessions ? malloc(sessions*sizeof *t.ids) : NULL;
+    t.ep=epoll_create1(0);
+    if(!nreq || !lat || !t.lc || (sessions && !t.ids) || t.ep<0){
+        fputs(nreq ? "Out of memory.\n" : "No requests.\n",stderr);
+        free(reqs); free(lat); free(t.lc); free(t.ids);
+        if(t.ep>=0) close(t.ep);
+        return 1;
+    }
+
+    struct sockaddr_un sa={ .sun_family=AF_UNIX };
+    snprintf(sa.sun_path,sizeof sa.sun_path,"%s",sock);
+    int rc=0;
+    for(int i=0;i<t.conns;i++){
+        t.lc[i].fd=socket(AF_UNIX,SOCK_STREAM,0);
+        t.lc[i].sent_at=malloc((size_t)t.depth*sizeof(double));
+        struct epoll_event ev={ .events=EPOLLIN, .data.ptr=&t.lc[i] };
+        if(t.lc[i].fd<0 || !t.lc[i].sent_at || connect(t.lc[i].fd,(struct sockaddr*)&sa,sizeof sa)!=0
+           || epoll_ctl(t.ep,EPOLL_CTL_ADD,t.lc[i].fd,&ev)!=0){
+            perror(sock);
+            rc=1;
+            t.conns=i+1;
+            break;
         }
     }
-    return true;
+    if(rc==0 && sessions){
+        unsigned long long errors=0;
+        double t0=now_seconds();
+        unsigned long long done=load_run(&t,sessions,false,lat,&errors);
+        load_report("sessions opened",lat,done,errors,now_seconds()-t0,&t);
+        if(done<sessions || !t.nids){ fputs("loadtest: could not open the sessions\n",stderr); rc=1; }
+    }
+    if(rc==0){
+        unsigned long long errors=0;
+        double t0=now_seconds();
+        unsigned long long done=load_run(&t,total,sessions>0,lat,&errors);
+        load_report("requests",lat,done,errors,now_seconds()-t0,&t);
+        if(done<total) rc=1;
+    }
+    for(int i=0;i<t.conns;i++){
+        if(t.lc[i].fd>=0) close(t.lc[i].fd);
+        free(t.lc[i].sent_at);
+    }
+    close(t.ep);
+    free(t.lc); free(lat); free(reqs); free(t.ids);
+    return rc;
 }
 
-static void prompt_difficulty(Difficulty* d){
-    char buf[64];
-    puts("Choose difficulty: easy / medium / hard [default: medium]");
-    printf("> "); fflush(stdout);
-    if(!read_line(buf,sizeof(buf))) { *d=DIFF_MEDIUM; return; }
-    for(char* p=buf; *p; ++p) *p=(char)tolower((unsigned char)*p);
-    if(buf[0]==0) { *d=DIFF_MEDIUM; return; }
-    *d = parse_difficulty(buf);
+#endif
+
+typedef struct {
+    const char* name;
+    int (*run)(int argc, char** argv);
+    const char* usage;
+} Mode;
+
+static const Mode modes[] = {
+    { "solve", mode_solve, "solve [-j N] [-l 8|16|32] [-s] [-H] [-c CACHE] [FILE]  solve each grid, LANES at a time" },
+    { "validate", mode_validate, "validate [-q] [-j N] [FILE]      check each grid, report the first bad unit" },
+    { "enum",  mode_enum,  "enum [-n MAX] [FILE]                 stream all solutions of each grid" },
+    { "count", mode_count, "count [-e bands|dfs] [-t MB] [-H] [FILE]  exact number of solutions of each grid" },
+    { "canon", mode_canon, "canon [-j N] [FILE]                  canonical (minlex) form of each grid" },
+    { "dedup", mode_dedup, "dedup [-c] [-j N] [FILE]             drop grids isomorphic to an earlier one" },
+    { "pack",  mode_pack,  "pack [-s] [-d easy|medium|hard] [FILE]  grid lines to a puzzle bank on stdout" },
+    { "unpack", mode_unpack, "unpack [-s] [-m] [-r FIRST[:COUNT]] [FILE]  puzzle bank to grid lines" },
+    { "expand", mode_expand, "expand [-n COUNT] [-s START] [-u] [FILE]  isomorphs of each seed grid" },
+    { "hunt", mode_hunt, "hunt [-e solve|count|lanes] [-m nodes|time] [-i ITERS] [-c CHAINS] [-k KEEP] [-j N] [FILE]  hardest puzzles for an engine" },
+    { "pattern", mode_pattern, "pattern [-n COUNT] [-t MS] [-j N] [-s SEED] [FILE]  puzzles with givens on each grid's given cells" },
+    { "bench", mode_bench, "bench [-g COUNT] [-s SEED] [-p] [-S SEARCH] [FILE]  latency (and -p hardware counters) of solve, count, generate" },
+#ifdef __linux__
+    { "serve", mode_serve, "serve [-j N] [-P RACERS] [-t MS] [-n NODES] SOCKET  solver requests and game sessions on a Unix socket" },
+    { "loadtest", mode_loadtest, "loadtest [-c CONNS] [-d DEPTH] [-n COUNT] [-r CMD] [-g SESSIONS] SOCKET [FILE]  latency of a running server" },
+#endif
+};
+
+static int run_mode(int argc, char** argv){
+    for(size_t i=0;i<sizeof(modes)/sizeof(modes[0]);i++)
+        if(strcmp(argv[1],modes[i].name)==0) return modes[i].run(argc-1, argv+1);
+    fprintf(stderr,"Usage: %s [-T TRACE.json] [MODE ...]  (no mode starts the game)\nModes:\n", argv[0]);
+    for(size_t i=0;i<sizeof(modes)/sizeof(modes[0]);i++) fprintf(stderr,"  %s\n", modes[i].usage);
+    return 2;
 }
 
-int main(void){
-    unsigned seed = (unsigned)time(NULL) ^ (unsigned)(uintptr_t)&seed;
-    srand(seed);
+#define PLAY_GENERATE_MS 300   // most boards take a millisecond or two
+
+// The interactive game.
+static int play(void){
+    uint64_t seed = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&seed;
+    sudoku_ctx* ctx=sudoku_new(seed);
+    if(!ctx){ fputs("Out of memory.\n",stderr); return 1; }
+    Portfolio pf;
+    portfolio_init(&pf,default_threads());
 
     Difficulty diff;
     prompt_difficulty(&diff);
 
     Board solution, puzzle, current, fixed;
+    uint8_t puz[N*N], sol[N*N];
 
-    generate_complete(&solution);
-    make_puzzle(&solution, &puzzle, diff);
+    // The generator only removes givens while the solution stays unique;
+    // a few tries within a blink reach the level's target of givens.
+    sudoku_budget budget={ .time_ns=PLAY_GENERATE_MS*1000000ull };
+    sudoku_generate_best(ctx, (sudoku_level)diff, &budget, puz, sol);
+    board_from_cells(&puzzle, puz);
+    board_from_cells(&solution, sol);
 
     copy_board(&current, &puzzle);
     copy_board(&fixed, &puzzle); // cells != 0 are fixed
 
-    // Safety: ensure legality & (ideally) uniqueness
-    if(!is_legal(&puzzle)){
-        fprintf(stderr,"Internal error: generated puzzle illegal. Regenerating...\n");
-        generate_complete(&solution);
-        make_puzzle(&solution, &puzzle, diff);
-        copy_board(&current, &puzzle);
-        copy_board(&fixed, &puzzle);
-    }
-    Board tmp=puzzle;
-    if(count_solutions(&tmp,2)!=1){
-        Board s2=puzzle;
-        if(solve_board(&s2)) solution=s2;
-        else generate_complete(&solution);
-    }
-
     puts("\nSudoku");
     print_board(&current);
     puts("Type 'help' for commands.");
@@ -469,7 +4620,7 @@ int main(void){
             puts("Restarted.");
             print_board(&current);
         } else if(strcmp(cmd,"check")==0){
-            if(!is_legal(&current)) puts("There are rule violations.");
+            if(check_board(&current)==SUDOKU_CONFLICT) puts("There are rule violations.");
             else if(is_complete_and_correct(&current)) puts("Looks complete and correct. Nice!");
             else puts("So far so good. No violations detected.");
         } else if(strcmp(cmd,"set")==0){
@@ -495,16 +4646,14 @@ int main(void){
             int r=a[0]-1, c=a[1]-1;
             if(r<0||r>=9||c<0||c>=9){ puts("r,c in 1..9"); continue; }
             if(fixed.grid[r][c]){ puts("That cell is a given."); continue; }
-            Board s=puzzle;
-            if(!solve_board(&s)){ puts("No solution found (puzzle invalid)."); continue; }
-            int v=s.grid[r][c];
+            int v=solution.grid[r][c];
             if(v==0){ puts("No hint available."); continue; }
             current.grid[r][c]=v;
             printf("Hint: set (%d,%d) = %d\n", r+1, c+1, v);
             print_board(&current);
         } else if(strcmp(cmd,"solve")==0){
             Board s=current;
-            if(!solve_board(&s)){
+            if(!solve_with(&pf,&s)){
                 puts("No solution from current state (there may be conflicts). Try 'check'.");
             } else {
                 current=s;
@@ -518,5 +4667,22 @@ int main(void){
         }
     }
 
+    sudoku_free(ctx);
     return 0;
 }
+
+// sudoku [-T TRACE.json] [MODE ...]
+// -T records phase trace events from every thread (see "Tracing") and
+// writes them to TRACE.json when the mode or game ends.
+int main(int argc, char** argv){
+    const char* trace=NULL;
+    if(argc>2 && strcmp(argv[1],"-T")==0){
+        trace=argv[2];
+        argv[2]=argv[0];
+        argc-=2; argv+=2;
+        trace_start();
+    }
+    int rc = argc>1 ? run_mode(argc,argv) : play();
+    if(trace && !trace_write(trace) && !rc) rc=1;
+    return rc;
+}
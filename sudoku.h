@@ -0,0 +1,145 @@
+// sudoku.h - public interface of libsudoku, the engine behind sudoku.c
+// Copyright 2025. Bogdan Drozdov. All rights reserved.
+//
+// Grids are 81 bytes in row-major order, 1..9 for a digit and 0 for an
+// empty cell. The library keeps no global state: everything a call needs
+// lives in its arguments or in a sudoku_ctx, so threads that each use
+// their own context never share anything. Calls that take no context are
+// safe from any thread.
+
+#ifndef SUDOKU_H
+#define SUDOKU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SUDOKU_API __attribute__((visibility("default")))
+#else
+#define SUDOKU_API
+#endif
+
+typedef struct sudoku_ctx sudoku_ctx;
+
+typedef enum { SUDOKU_EASY, SUDOKU_MEDIUM, SUDOKU_HARD } sudoku_level;
+
+// What a context times, one latency histogram each.
+typedef enum {
+    SUDOKU_OP_SOLVE,     // sudoku_solve
+    SUDOKU_OP_COUNT,     // sudoku_count
+    SUDOKU_OP_COMPLETE,  // sudoku_generate, making the complete grid
+    SUDOKU_OP_PUZZLE,    // sudoku_generate, removing givens while unique
+    SUDOKU_OPS
+} sudoku_op;
+
+// How sudoku_solve and sudoku_count search.
+typedef enum {
+    SUDOKU_SEARCH_PLAIN,     // most constrained cell first, digits 1 up (default)
+    SUDOKU_SEARCH_RESTARTS,  // ties and digits at random, restarted on Luby node budgets
+    SUDOKU_SEARCH_LCV        // least constraining digit first (fewest empty peers allow it)
+} sudoku_search;
+
+typedef enum {
+    SUDOKU_SOLVED,       // complete, no digit repeated in a unit
+    SUDOKU_OPEN,         // no repeated digit, but empty cells left
+    SUDOKU_CONFLICT,     // a digit repeated in a row, column or box
+    SUDOKU_MALFORMED     // a cell outside 0..9
+} sudoku_check;
+
+// Limits of one budgeted call; zero fields impose nothing. The clock and
+// the flag are looked at every 256 search nodes or so, a few tens of
+// microseconds apart.
+typedef struct {
+    uint64_t time_ns;        // give up after this long
+    uint64_t max_nodes;      // give up after this many search nodes
+    const int* cancel;       // give up once nonzero; set it with __atomic_store_n
+} sudoku_budget;
+
+// What a budgeted call spent, filled in whether or not it gave up.
+typedef struct {
+    uint64_t nodes;          // search nodes
+    uint64_t ns;
+    int solutions;           // found so far: a lower bound when it gave up
+} sudoku_stats;
+
+#define SUDOKU_GAVE_UP (-2)  // a budgeted call ran out: no answer either way
+
+// A context with its own random generator seeded from 'seed'; NULL when
+// out of memory. Generation from equal seeds gives equal puzzles.
+SUDOKU_API sudoku_ctx* sudoku_new(uint64_t seed);
+SUDOKU_API void sudoku_free(sudoku_ctx* ctx);
+SUDOKU_API void sudoku_seed(sudoku_ctx* ctx, uint64_t seed);
+
+// Sets how 'ctx' solves. Restarts cut the long tail of hard puzzles and
+// keep every answer exact, but of several solutions sudoku_solve may then
+// return any one. They draw from their own stream: generation stays
+// repeatable. Counting always uses the plain order.
+SUDOKU_API void sudoku_set_search(sudoku_ctx* ctx, sudoku_search search);
+
+// Solves 'grid' into 'out' (which may be 'grid'): 1 if solved, 0 if there
+// is no solution, -1 if the grid is malformed. With several solutions the
+// first one found is returned.
+SUDOKU_API int sudoku_solve(sudoku_ctx* ctx, const uint8_t grid[81], uint8_t out[81]);
+
+// Number of solutions of 'grid', stopping at 'limit'; -1 if malformed.
+// Large limits use a transposition table owned by the context.
+SUDOKU_API int sudoku_count(sudoku_ctx* ctx, const uint8_t grid[81], int limit);
+
+// sudoku_solve and sudoku_count within 'budget' (NULL: none): as those,
+// or SUDOKU_GAVE_UP. 'stats' (optional) gets what the call spent. Use
+// these on grids from untrusted sources, where a crafted grid can make
+// the search run for hours.
+SUDOKU_API int sudoku_solve_budget(sudoku_ctx* ctx, const uint8_t grid[81], uint8_t out[81],
+                                   const sudoku_budget* budget, sudoku_stats* stats);
+SUDOKU_API int sudoku_count_budget(sudoku_ctx* ctx, const uint8_t grid[81], int limit,
+                                   const sudoku_budget* budget, sudoku_stats* stats);
+
+// A random puzzle with a unique solution at 'level' and that solution
+// ('solution' may be NULL). Returns the number of givens.
+SUDOKU_API int sudoku_generate(sudoku_ctx* ctx, sudoku_level level, uint8_t puzzle[81],
+                               uint8_t solution[81]);
+
+// sudoku_generate that keeps making puzzles from fresh grids until one
+// reaches the level's target of givens (27 for hard) or 'budget' runs out,
+// and returns the best: fewest givens, then on ties the hardest rating for
+// SUDOKU_HARD and the easiest for SUDOKU_EASY. Only the time and cancel
+// limits apply; without either, or with one spent on entry, it makes one
+// attempt, as sudoku_generate, which misses the hard target about half
+// the time.
+SUDOKU_API int sudoku_generate_best(sudoku_ctx* ctx, sudoku_level level, const sudoku_budget* budget,
+                                    uint8_t puzzle[81], uint8_t solution[81]);
+
+// A random puzzle with its givens exactly on the nonzero cells of 'mask'
+// and its solution ('solution' may be NULL). Returns the number of givens,
+// 0 if no puzzle can have that pattern (under 17 cells, or two rows of a
+// band or two columns of a stack left empty), or SUDOKU_GAVE_UP when the
+// time or cancel limit of 'budget' runs out. Without one it keeps trying,
+// so pass one for patterns that may admit no puzzle.
+SUDOKU_API int sudoku_generate_pattern(sudoku_ctx* ctx, const uint8_t mask[81], const sudoku_budget* budget,
+                                       uint8_t puzzle[81], uint8_t solution[81]);
+
+// Search nodes needed to solve 'puzzle' and prove the solution unique, a
+// rough difficulty rating; -1 unless it has exactly one solution.
+SUDOKU_API long long sudoku_rate(sudoku_ctx* ctx, const uint8_t puzzle[81]);
+
+// Checks the rules on 'grid'. For SUDOKU_CONFLICT, '*unit' (if not NULL)
+// gets the first unit with a repeated digit: rows 0-8, columns 9-17, boxes
+// 18-26; otherwise -1.
+SUDOKU_API sudoku_check sudoku_validate(const uint8_t grid[81], int* unit);
+
+// Latency of 'op' through 'ctx' at quantile 'q' (0.5 for the median, 1 for
+// the maximum) in nanoseconds, within 1.6%; 0 before the first call. Any
+// thread may ask while the context's owner keeps recording.
+SUDOKU_API uint64_t sudoku_latency(const sudoku_ctx* ctx, sudoku_op op, double q);
+
+// Number of 'op' calls timed through 'ctx'.
+SUDOKU_API uint64_t sudoku_calls(const sudoku_ctx* ctx, sudoku_op op);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
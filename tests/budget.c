@@ -0,0 +1,58 @@
+// The budgeted calls: a node limit and a cancel flag make them give up
+// with the spent nodes reported, and a count cut short leaves nothing
+// behind in the context's transposition table.
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "sudoku.h"
+
+static const char GRID[]="53..7....6..195....98....6.8...6...34..8.3..17...2...6.6....28....419..5....8..79";
+
+static int fails;
+
+static void expect(bool ok, const char* what){
+    if(ok) return;
+    fprintf(stderr,"failed: %s\n", what);
+    fails++;
+}
+
+static void cells(const char* s, uint8_t out[81]){
+    for(int i=0;i<81;i++) out[i] = s[i]>='1' && s[i]<='9' ? (uint8_t)(s[i]-'0') : 0;
+}
+
+int main(void){
+    sudoku_ctx* ctx=sudoku_new(1);
+    sudoku_ctx* fresh=sudoku_new(1);
+    if(!ctx || !fresh){ fputs("Out of memory.\n",stderr); return 1; }
+    uint8_t grid[81], out[81], empty[81]={0};
+    cells(GRID,grid);
+    sudoku_stats st;
+
+    sudoku_budget nodes={ .max_nodes=1000 };
+    expect(sudoku_count_budget(ctx,empty,1000000,&nodes,&st)==SUDOKU_GAVE_UP, "count gives up past max_nodes");
+    expect(st.nodes>=1000 && st.nodes<=1001, "count reports the nodes it spent");
+    nodes.max_nodes=1;
+    expect(sudoku_solve_budget(ctx,grid,out,&nodes,&st)==SUDOKU_GAVE_UP, "solve gives up past max_nodes");
+    expect(st.nodes>=1, "solve reports the nodes it spent");
+
+    int cancel=1;
+    sudoku_budget flag={ .cancel=&cancel };
+    expect(sudoku_solve_budget(ctx,grid,out,&flag,&st)==SUDOKU_GAVE_UP, "solve gives up when cancelled");
+    expect(sudoku_count_budget(ctx,grid,2,&flag,&st)==SUDOKU_GAVE_UP, "count gives up when cancelled");
+    cancel=0;
+    expect(sudoku_solve_budget(ctx,grid,out,&flag,&st)==1, "solve runs with the flag clear");
+
+    // 24 cells cleared: 232116 solutions, exact under the limit and well
+    // past the table's threshold
+    uint8_t open[81];
+    memcpy(open,grid,sizeof open);
+    memset(open,0,24);
+    sudoku_budget cut={ .max_nodes=5000 };
+    expect(sudoku_count_budget(ctx,open,1000000,&cut,&st)==SUDOKU_GAVE_UP, "a large count is cut short");
+    int n=sudoku_count(ctx,open,1000000);
+    expect(n==232116 && n==sudoku_count(fresh,open,1000000), "a cut count leaves the table exact");
+
+    sudoku_free(ctx);
+    sudoku_free(fresh);
+    return fails!=0;
+}
@@ -0,0 +1,22 @@
+// Regression: sudoku_count stops at its limit, however much of the count
+// comes from transposition-table hits. The INT_MAX case, where overshooting
+// overflowed, runs through "sudoku count" (see CMakeLists.txt): its larger
+// table takes a fraction of the time.
+#include <stdio.h>
+#include "sudoku.h"
+
+static int check(sudoku_ctx* ctx, int limit){
+    uint8_t empty[81]={0};
+    int n=sudoku_count(ctx,empty,limit);
+    if(n==limit) return 0;
+    fprintf(stderr,"count of the empty grid to %d: got %d\n", limit, n);
+    return 1;
+}
+
+int main(void){
+    sudoku_ctx* ctx=sudoku_new(1);
+    if(!ctx){ fputs("Out of memory.\n",stderr); return 1; }
+    int bad=check(ctx,10000000);
+    sudoku_free(ctx);
+    return bad!=0;
+}
@@ -0,0 +1,42 @@
+// sudoku_generate_pattern on the givens of generated puzzles: the result
+// has its givens exactly on the mask, one solution, and that solution is
+// a valid grid agreeing with the givens. Masks under 17 cells give 0.
+#include <stdbool.h>
+#include <stdio.h>
+#include "sudoku.h"
+
+static int fails;
+
+static void expect(bool ok, int k, const char* what){
+    if(ok) return;
+    fprintf(stderr,"mask %d: %s\n", k, what);
+    fails++;
+}
+
+int main(void){
+    sudoku_ctx* ctx=sudoku_new(7);
+    if(!ctx){ fputs("Out of memory.\n",stderr); return 1; }
+    for(int k=0;k<5;k++){
+        uint8_t mask[81], puzzle[81], solution[81];
+        sudoku_generate(ctx,k%2 ? SUDOKU_HARD : SUDOKU_MEDIUM,mask,NULL);
+        sudoku_budget budget={ .time_ns=30000000000ull };
+        int givens=sudoku_generate_pattern(ctx,mask,&budget,puzzle,solution);
+        expect(givens>0,k,"no puzzle");
+        if(givens<=0) continue;
+        int n=0;
+        bool on_mask=true, agrees=true;
+        for(int i=0;i<81;i++){
+            n+=puzzle[i]!=0;
+            on_mask = on_mask && (puzzle[i]!=0)==(mask[i]!=0);
+            agrees = agrees && (!puzzle[i] || puzzle[i]==solution[i]);
+        }
+        expect(on_mask && n==givens,k,"givens off the mask");
+        expect(sudoku_count(ctx,puzzle,2)==1,k,"not unique");
+        expect(sudoku_validate(solution,NULL)==SUDOKU_SOLVED && agrees,k,"bad solution");
+    }
+    uint8_t sparse[81]={0}, puzzle[81];
+    for(int i=0;i<16;i++) sparse[i*5]=1;
+    expect(sudoku_generate_pattern(ctx,sparse,NULL,puzzle,NULL)==0,5,"16 cells accepted");
+    sudoku_free(ctx);
+    return fails!=0;
+}
@@ -0,0 +1,11 @@
+#!/bin/sh
+# sudoku pattern: a puzzle for a good pattern, a report and exit status 1
+# for one that cannot be unique (16 cells).
+sudoku="$1"
+good=1.11.......1....1.1...11...1...1...1.1..1..1.1...1...1...11...1.1....1.......1111
+bad=1111111111111111.................................................................
+out=$(printf '%s\n%s\n' "$good" "$bad" | "$sudoku" pattern -j 2 -s 1 2>/dev/null)
+status=$?
+[ "$status" -eq 1 ] || { echo "exit status $status, expected 1"; exit 1; }
+echo "$out" | grep -Eqx '[1-9.]{81}' || { echo "no puzzle for the good pattern"; exit 1; }
+[ "$(echo "$out" | wc -l)" -eq 1 ] || { echo "expected one puzzle"; exit 1; }
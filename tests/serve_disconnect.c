@@ -0,0 +1,107 @@
+// Regression: clients that hang up while their requests are still being
+// worked on must not bring "sudoku serve" down. Replies for such a client
+// and its hang-up can land in one epoll batch; the server used to free the
+// connection on the first and then touch it on the second. Build with
+// -fsanitize=address to see the bug itself rather than a likely crash.
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GRID "53..7....6..195....98....6.8...6...34..8.3..17...2...6.6....28....419..5....8..79"
+#define EMPTY "................................................................................."
+
+static struct sockaddr_un addr;
+
+static int dial(void){
+    int fd=socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd>=0 && connect(fd,(struct sockaddr*)&addr,sizeof addr)==0) return fd;
+    if(fd>=0) close(fd);
+    return -1;
+}
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void send_all(int fd, const char* s, size_t n){
+    while(n){
+        ssize_t k=send(fd,s,n,MSG_NOSIGNAL);
+        if(k<=0) return;
+        s+=k; n-=(size_t)k;
+    }
+}
+
+// Reads one reply line into 'buf'; false on a closed or broken socket.
+static bool read_line(int fd, char* buf, size_t cap){
+    size_t n=0;
+    while(n+1<cap){
+        ssize_t k=read(fd,buf+n,1);
+        if(k<=0) return false;
+        if(buf[n++]=='\n') break;
+    }
+    buf[n]=0;
+    return true;
+}
+
+int main(int argc, char** argv){
+    if(argc<2){ fputs("usage: serve_disconnect SUDOKU\n",stderr); return 2; }
+    addr.sun_family=AF_UNIX;
+    snprintf(addr.sun_path,sizeof addr.sun_path,"/tmp/sudoku-test-%d.sock",(int)getpid());
+    pid_t pid=fork();
+    if(pid<0){ perror("fork"); return 1; }
+    if(pid==0){
+        if(!freopen("/dev/null","w",stderr)) _exit(127);
+        execl(argv[1],argv[1],"serve","-j","4",addr.sun_path,(char*)NULL);
+        _exit(127);
+    }
+    int fd=-1;
+    for(int i=0;i<250 && (fd=dial())<0;i++) usleep(20000);
+    if(fd<0){ fputs("server did not come up\n",stderr); kill(pid,SIGKILL); waitpid(pid,NULL,0); return 1; }
+
+    // The flood keeps the main thread busy so that events pile up into
+    // large batches; the quitters hang up with counts in flight.
+    static const char count_req[]="count " EMPTY " 3000\n";
+    static const char validate_req[]="validate " GRID "\n";
+    char line[256];
+    unsigned seed=(unsigned)getpid();
+    bool ok=true;
+    for(double stop=now()+3; ok && now()<stop;){
+        for(int i=0;i<100;i++) send_all(fd,validate_req,sizeof validate_req-1);
+        for(int i=0;i<16;i++){
+            int q=dial();
+            if(q<0) continue;
+            send_all(q,count_req,sizeof count_req-1);
+            send_all(q,count_req,sizeof count_req-1);
+            usleep((useconds_t)(rand_r(&seed)%2000));
+            close(q);
+        }
+        for(int i=0;i<100 && ok;i++) ok=read_line(fd,line,sizeof line) && strncmp(line,"ok ",3)==0;
+    }
+    close(fd);
+    if(ok){
+        fd=dial();
+        send_all(fd,validate_req,sizeof validate_req-1);
+        ok = fd>=0 && read_line(fd,line,sizeof line) && strncmp(line,"ok ",3)==0;
+        if(fd>=0) close(fd);
+    }
+    if(!ok) fputs("server stopped answering\n",stderr);
+    kill(pid,SIGTERM);
+    int status;
+    waitpid(pid,&status,0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status)!=0){
+        fprintf(stderr,"server did not exit cleanly (status %d)\n",status);
+        ok=false;
+    }
+    unlink(addr.sun_path);
+    return ok ? 0 : 1;
+}